@@ -1529,13 +1529,145 @@ namespace agg
         Container m_vertices;
     };
 
+    //-------------------------------------------------vertex_integer_storage
+    // Vertex container for paths whose coordinates are integers, such as
+    // outlines in twips. Coordinates are stored as T and commands in a
+    // separate array, so with int32 a vertex takes 9 bytes instead of the
+    // 17 of vertex_block_storage<double>. Non-integer coordinates are
+    // rounded.
+    template<class T, unsigned S=8> class vertex_integer_storage
+    {
+    public:
+        typedef T value_type;
+
+        void remove_all() { m_coords.remove_all(); m_cmds.remove_all(); }
+        void free_all()   { m_coords.free_all();   m_cmds.free_all(); }
+
+        void add_vertex(double x, double y, unsigned cmd)
+        {
+            m_coords.add(point_base<T>(T(iround(x)), T(iround(y))));
+            m_cmds.add(int8u(cmd));
+        }
+
+        void modify_vertex(unsigned idx, double x, double y)
+        {
+            m_coords[idx] = point_base<T>(T(iround(x)), T(iround(y)));
+        }
+
+        void modify_vertex(unsigned idx, double x, double y, unsigned cmd)
+        {
+            m_coords[idx] = point_base<T>(T(iround(x)), T(iround(y)));
+            m_cmds[idx] = int8u(cmd);
+        }
+
+        void modify_command(unsigned idx, unsigned cmd)
+        {
+            m_cmds[idx] = int8u(cmd);
+        }
+
+        void swap_vertices(unsigned v1, unsigned v2)
+        {
+            point_base<T> p = m_coords[v1];
+            m_coords[v1] = m_coords[v2];
+            m_coords[v2] = p;
+            int8u cmd = m_cmds[v1];
+            m_cmds[v1] = m_cmds[v2];
+            m_cmds[v2] = cmd;
+        }
+
+        unsigned last_command() const
+        {
+            return m_cmds.size() ? m_cmds[m_cmds.size() - 1] : path_cmd_stop;
+        }
+
+        unsigned last_vertex(double* x, double* y) const
+        {
+            if(m_coords.size() == 0)
+            {
+                *x = *y = 0.0;
+                return path_cmd_stop;
+            }
+            return vertex(m_coords.size() - 1, x, y);
+        }
+
+        unsigned prev_vertex(double* x, double* y) const
+        {
+            if(m_coords.size() < 2)
+            {
+                *x = *y = 0.0;
+                return path_cmd_stop;
+            }
+            return vertex(m_coords.size() - 2, x, y);
+        }
+
+        double last_x() const
+        {
+            return m_coords.size() ? m_coords[m_coords.size() - 1].x : 0.0;
+        }
+
+        double last_y() const
+        {
+            return m_coords.size() ? m_coords[m_coords.size() - 1].y : 0.0;
+        }
+
+        unsigned total_vertices() const
+        {
+            return m_coords.size();
+        }
+
+        unsigned vertex(unsigned idx, double* x, double* y) const
+        {
+            const point_base<T>& p = m_coords[idx];
+            *x = p.x;
+            *y = p.y;
+            return m_cmds[idx];
+        }
+
+        unsigned command(unsigned idx) const
+        {
+            return m_cmds[idx];
+        }
+
+    private:
+        pod_bvector<point_base<T>, S> m_coords;
+        pod_bvector<int8u, S>         m_cmds;
+    };
+
     //-----------------------------------------------------------path_storage
     typedef path_base<vertex_block_storage<double> > path_storage;
 
+    //---------------------------------------------------path_storage_int32
+    typedef path_base<vertex_integer_storage<int32> > path_storage_int32;
+
     // Example of declarations path_storage with pod_bvector as a container
     //-----------------------------------------------------------------------
     //typedef path_base<vertex_stl_storage<pod_bvector<vertex_d> > > path_storage;
 
+    //----------------------------------------------------path_storage_reader
+    // Vertex source over a const path. Unlike the path's own rewind() and
+    // vertex() it keeps the iterator to itself, so any number of readers,
+    // in any number of threads, can read the same path at once.
+    template<class Path> class path_storage_reader
+    {
+    public:
+        explicit path_storage_reader(const Path& path) :
+            m_path(path),
+            m_index(0)
+        {}
+
+        void rewind(unsigned path_id) { m_index = path_id; }
+
+        unsigned vertex(double* x, double* y)
+        {
+            if(m_index >= m_path.total_vertices()) return path_cmd_stop;
+            return m_path.vertex(m_index++, x, y);
+        }
+
+    private:
+        const Path& m_path;
+        unsigned    m_index;
+    };
+
 }
 
 
@@ -41,6 +41,7 @@
 
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "agg_math.h"
 #include "agg_array.h"
 
@@ -48,6 +49,73 @@
 namespace agg
 {
 
+    //---------------------------------------------------cell_block_allocator
+    // Free cell blocks kept per thread, so that the rasterizers which come
+    // and go while a frame is drawn (one per shape) reuse each other's
+    // blocks rather than allocating their own. Each thread keeps up to
+    // max_blocks of them, which are freed when the thread exits.
+    template<class Cell, unsigned BlockSize> class cell_block_allocator
+    {
+    public:
+        enum { max_blocks = 64 };
+
+        static Cell* allocate()
+        {
+            free_list* fl = get();
+            if(fl->num) return fl->blocks[--fl->num];
+            return pod_allocator<Cell>::allocate(BlockSize);
+        }
+
+        static void deallocate(Cell* block)
+        {
+            free_list* fl = get();
+            if(fl->num < max_blocks)
+            {
+                fl->blocks[fl->num++] = block;
+                return;
+            }
+            pod_allocator<Cell>::deallocate(block, BlockSize);
+        }
+
+    private:
+        struct free_list
+        {
+            Cell*    blocks[max_blocks];
+            unsigned num;
+        };
+
+        static void make_key() { pthread_key_create(&s_key, destroy); }
+
+        static void destroy(void* p)
+        {
+            free_list* fl = (free_list*)p;
+            while(fl->num) pod_allocator<Cell>::deallocate(fl->blocks[--fl->num], BlockSize);
+            delete fl;
+        }
+
+        static free_list* get()
+        {
+            pthread_once(&s_once, make_key);
+            free_list* fl = (free_list*)pthread_getspecific(s_key);
+            if(fl == 0)
+            {
+                fl = new free_list;
+                fl->num = 0;
+                pthread_setspecific(s_key, fl);
+            }
+            return fl;
+        }
+
+        static pthread_key_t  s_key;
+        static pthread_once_t s_once;
+    };
+
+    template<class Cell, unsigned BlockSize>
+    pthread_key_t cell_block_allocator<Cell, BlockSize>::s_key;
+
+    template<class Cell, unsigned BlockSize>
+    pthread_once_t cell_block_allocator<Cell, BlockSize>::s_once = PTHREAD_ONCE_INIT;
+
     //-----------------------------------------------------rasterizer_cells_aa
     // An internal class that implements the main rasterization algorithm.
     // Used in the rasterizer. Should not be used direcly.
@@ -68,6 +136,8 @@ namespace agg
             unsigned num;
         };
 
+        typedef cell_block_allocator<Cell, cell_block_size> block_allocator;
+
     public:
         typedef Cell cell_type;
         typedef rasterizer_cells_aa<Cell> self_type;
@@ -79,12 +149,29 @@ namespace agg
         void style(const cell_type& style_cell);
         void line(int x1, int y1, int x2, int y2);
 
+        // Keeps only what can affect pixels inside the window (x1, y1) -
+        // (x2, y2), inclusive. Rows outside it are dropped and cells to
+        // either side are moved to the column just outside it, so that the
+        // cover accumulated across every row stays exact inside.
+        void window(int x1, int y1, int x2, int y2)
+        {
+            m_windowed = true;
+            m_wx1 = x1;
+            m_wy1 = y1;
+            m_wx2 = x2;
+            m_wy2 = y2;
+        }
+        void reset_window() { m_windowed = false; }
+
         int min_x() const { return m_min_x; }
         int min_y() const { return m_min_y; }
         int max_x() const { return m_max_x; }
         int max_y() const { return m_max_y; }
 
-        void sort_cells();
+        // Buckets the cells by row and, unless sort_x is false, sorts each
+        // row by x. Callers that only need some of a row's cells in order
+        // can sort those themselves more cheaply.
+        void sort_cells(bool sort_x = true);
 
         unsigned total_cells() const 
         {
@@ -128,6 +215,11 @@ namespace agg
         int                     m_max_x;
         int                     m_max_y;
         bool                    m_sorted;
+        bool                    m_windowed;
+        int                     m_wx1;
+        int                     m_wy1;
+        int                     m_wx2;
+        int                     m_wy2;
     };
 
 
@@ -142,7 +234,7 @@ namespace agg
             cell_type** ptr = m_cells + m_num_blocks - 1;
             while(m_num_blocks--)
             {
-                pod_allocator<cell_type>::deallocate(*ptr, cell_block_size);
+                block_allocator::deallocate(*ptr);
                 ptr--;
             }
             pod_allocator<cell_type*>::deallocate(m_cells, m_max_blocks);
@@ -164,7 +256,12 @@ namespace agg
         m_min_y(0x7FFFFFFF),
         m_max_x(-0x7FFFFFFF),
         m_max_y(-0x7FFFFFFF),
-        m_sorted(false)
+        m_sorted(false),
+        m_windowed(false),
+        m_wx1(0),
+        m_wy1(0),
+        m_wx2(0),
+        m_wy2(0)
     {
         m_style_cell.initial();
         m_curr_cell.initial();
@@ -191,12 +288,23 @@ namespace agg
     {
         if(m_curr_cell.area | m_curr_cell.cover)
         {
+            int x = m_curr_cell.x;
+            if(m_windowed)
+            {
+                if(m_curr_cell.y < m_wy1 || m_curr_cell.y > m_wy2) return;
+                // Stay within the outline's extent, which sizes the
+                // scanlines.
+                if(x < m_wx1)      x = (m_wx1 - 1 < m_max_x) ? m_wx1 - 1 : m_max_x;
+                else if(x > m_wx2) x = (m_wx2 + 1 > m_min_x) ? m_wx2 + 1 : m_min_x;
+            }
             if((m_num_cells & cell_block_mask) == 0)
             {
                 if(m_num_blocks >= cell_block_limit) return;
                 allocate_block();
             }
-            *m_curr_cell_ptr++ = m_curr_cell;
+            *m_curr_cell_ptr = m_curr_cell;
+            m_curr_cell_ptr->x = x;
+            ++m_curr_cell_ptr;
             ++m_num_cells;
         }
     }
@@ -493,8 +601,7 @@ namespace agg
                 m_max_blocks += cell_block_pool;
             }
 
-            m_cells[m_num_blocks++] = 
-                pod_allocator<cell_type>::allocate(cell_block_size);
+            m_cells[m_num_blocks++] = block_allocator::allocate();
 
         }
         m_curr_cell_ptr = m_cells[m_curr_block++];
@@ -630,7 +737,7 @@ namespace agg
 
     //------------------------------------------------------------------------
     template<class Cell> 
-    void rasterizer_cells_aa<Cell>::sort_cells()
+    void rasterizer_cells_aa<Cell>::sort_cells(bool sort_x)
     {
         if(m_sorted) return; //Perform sort only the first time.
 
@@ -721,7 +828,7 @@ namespace agg
         }
 
         // Finally arrange the X-arrays
-        for(i = 0; i < m_sorted_y.size(); i++)
+        for(i = 0; sort_x && i < m_sorted_y.size(); i++)
         {
             const sorted_y& curr_y = m_sorted_y[i];
             if(curr_y.num)
@@ -86,7 +86,6 @@ namespace agg
         { 
             unsigned start_cell;
             unsigned num_cells;
-            int      last_x;
         };
 
         struct cell_info
@@ -94,11 +93,25 @@ namespace agg
             int x, area, cover; 
         };
 
+        static bool cell_x_less(const cell_info& a, const cell_info& b)
+        {
+            return a.x < b.x;
+        }
+
     public:
         typedef Clip                      clip_type;
         typedef typename Clip::conv_type  conv_type;
         typedef typename Clip::coord_type coord_type;
 
+        // Rows with at least dense_row_min_cells cells, spread over no more
+        // than dense_row_max_spread pixels per cell, are sorted by
+        // counting rather than style by style.
+        enum dense_row_e
+        {
+            dense_row_min_cells  = 64,
+            dense_row_max_spread = 4
+        };
+
         enum aa_scale_e
         {
             aa_shift  = 8,
@@ -118,6 +131,8 @@ namespace agg
             m_ast(),     // Active Style Table (unique values)
             m_asm(),     // Active Style Mask 
             m_cells(),
+            m_x_start(),
+            m_row_cells(),
             m_cover_buf(),
             m_master_alpha(),
             m_min_style(0x7FFFFFFF),
@@ -133,6 +148,10 @@ namespace agg
         void reset(); 
         void reset_clipping();
         void clip_box(double x1, double y1, double x2, double y2);
+        // See rasterizer_cells_aa::window(). Unlike clip_box() this leaves
+        // the coverage inside the window exactly as without it.
+        void cell_window(int x1, int y1, int x2, int y2) { m_outline.window(x1, y1, x2, y2); }
+        void reset_cell_window() { m_outline.reset_window(); }
         void filling_rule(filling_rule_e filling_rule);
         void layer_order(layer_order_e order);
         void master_alpha(int style, double alpha);
@@ -206,7 +225,11 @@ namespace agg
 
         //--------------------------------------------------------------------
         // Sweeps one scanline with one style index. The style ID can be 
-        // determined by calling style(). 
+        // determined by calling style(). A negative style_idx gives one
+        // full span from the first cell of the scanline to the last, which
+        // covers every pixel any style paints. Sweeping the "no fill"
+        // style instead only finds those pixels when the styles form a
+        // planar map, and strokes overlap the fills they are drawn with.
         template<class Scanline> bool sweep_scanline(Scanline& sl, int style_idx)
         {
             int scan_y = m_scan_y - 1;
@@ -214,18 +237,16 @@ namespace agg
 
             sl.reset_spans();
 
-            unsigned master_alpha = aa_mask;
-
-            if(style_idx < 0) 
-            {
-                style_idx = 0;
-            }
-            else 
+            if(style_idx < 0)
             {
-                style_idx++;
-                master_alpha = m_master_alpha[m_ast[style_idx] + m_min_style - 1];
+                sl.add_span(m_sl_start, m_sl_len, cover_full);
+                sl.finalize(scan_y);
+                return true;
             }
 
+            style_idx++;
+            unsigned master_alpha = m_master_alpha[m_ast[style_idx] + m_min_style - 1];
+
             const style_info& st = m_styles[m_ast[style_idx]];
 
             unsigned num_cells = st.num_cells;
@@ -285,6 +306,9 @@ namespace agg
         pod_vector<unsigned>   m_ast;     // Active Style Table (unique values)
         pod_vector<int8u>      m_asm;     // Active Style Mask 
         pod_vector<cell_info>  m_cells;
+        // Counting sort of dense rows by x.
+        pod_vector<unsigned>   m_x_start;
+        pod_vector<const cell_style_aa*> m_row_cells;
         pod_vector<cover_type> m_cover_buf;
         pod_bvector<unsigned>  m_master_alpha;
 
@@ -448,14 +472,14 @@ namespace agg
     template<class Clip> 
     AGG_INLINE void rasterizer_compound_aa<Clip>::sort()
     {
-        m_outline.sort_cells();
+        m_outline.sort_cells(false);
     }
 
     //------------------------------------------------------------------------
     template<class Clip> 
     AGG_INLINE bool rasterizer_compound_aa<Clip>::rewind_scanlines()
     {
-        m_outline.sort_cells();
+        m_outline.sort_cells(false);
         if(m_outline.total_cells() == 0) 
         {
             return false;
@@ -487,7 +511,6 @@ namespace agg
             m_asm[nbyte] |= mask;
             style->start_cell = 0;
             style->num_cells = 0;
-            style->last_x = -0x7FFFFFFF;
         }
         ++style->start_cell;
     }
@@ -504,7 +527,6 @@ namespace agg
             const cell_style_aa* const* cells = m_outline.scanline_cells(m_scan_y);
             unsigned num_styles = m_max_style - m_min_style + 2;
             const cell_style_aa* curr_cell;
-            unsigned style_id;
             style_info* style;
             cell_info* cell;
 
@@ -522,16 +544,22 @@ namespace agg
                 style = &m_styles[0];
                 style->start_cell = 0;
                 style->num_cells = 0;
-                style->last_x = -0x7FFFFFFF;
 
-                m_sl_start = cells[0]->x;
-                m_sl_len   = cells[num_cells-1]->x - m_sl_start + 1;
+                // Rows are not sorted by x (see sort_cells()). Only the
+                // cells of each style need to be, and sorting them style by
+                // style is much cheaper when a row holds many styles.
+                int min_x = cells[0]->x;
+                int max_x = min_x;
                 while(num_cells--)
                 {
                     curr_cell = *cells++;
+                    if(curr_cell->x < min_x) min_x = curr_cell->x;
+                    if(curr_cell->x > max_x) max_x = curr_cell->x;
                     add_style(curr_cell->left);
                     add_style(curr_cell->right);
                 }
+                m_sl_start = min_x;
+                m_sl_len   = max_x - min_x + 1;
 
                 // Convert the Y-histogram into the array of starting indexes
                 unsigned i;
@@ -547,49 +575,82 @@ namespace agg
                 cells = m_outline.scanline_cells(m_scan_y);
                 num_cells = m_outline.scanline_num_cells(m_scan_y);
 
-                while(num_cells--)
+                // A dense row is put in x order up front with a counting
+                // sort, which leaves every style's cells in order as they
+                // are handed out below.
+                const bool dense = num_cells >= dense_row_min_cells &&
+                                   m_sl_len <= num_cells * dense_row_max_spread;
+                if(dense)
                 {
-                    curr_cell = *cells++;
-                    style_id = (curr_cell->left < 0) ? 0 : 
-                                curr_cell->left - m_min_style + 1;
-
-                    style = &m_styles[style_id];
-                    if(curr_cell->x == style->last_x)
+                    m_x_start.allocate(m_sl_len, 256);
+                    m_x_start.zero();
+                    for(i = 0; i < num_cells; i++)
                     {
-                        cell = &m_cells[style->start_cell + style->num_cells - 1];
-                        cell->area  += curr_cell->area;
-                        cell->cover += curr_cell->cover;
+                        m_x_start[cells[i]->x - min_x]++;
                     }
-                    else
+                    unsigned start = 0;
+                    for(i = 0; i < m_sl_len; i++)
                     {
+                        unsigned v = m_x_start[i];
+                        m_x_start[i] = start;
+                        start += v;
+                    }
+                    m_row_cells.allocate(num_cells, 256);
+                    for(i = 0; i < num_cells; i++)
+                    {
+                        m_row_cells[m_x_start[cells[i]->x - min_x]++] = cells[i];
+                    }
+                    cells = m_row_cells.data();
+                }
+
+                // Hand the cells out to their styles. The "no fill" style
+                // is never swept, so its cells are left out.
+
+                while(num_cells--)
+                {
+                    curr_cell = *cells++;
+                    if(curr_cell->left >= 0)
+                    {
+                        style = &m_styles[curr_cell->left - m_min_style + 1];
                         cell = &m_cells[style->start_cell + style->num_cells];
                         cell->x       = curr_cell->x;
                         cell->area    = curr_cell->area;
                         cell->cover   = curr_cell->cover;
-                        style->last_x = curr_cell->x;
                         style->num_cells++;
                     }
-
-                    style_id = (curr_cell->right < 0) ? 0 : 
-                                curr_cell->right - m_min_style + 1;
-
-                    style = &m_styles[style_id];
-                    if(curr_cell->x == style->last_x)
-                    {
-                        cell = &m_cells[style->start_cell + style->num_cells - 1];
-                        cell->area  -= curr_cell->area;
-                        cell->cover -= curr_cell->cover;
-                    }
-                    else
+                    if(curr_cell->right >= 0)
                     {
+                        style = &m_styles[curr_cell->right - m_min_style + 1];
                         cell = &m_cells[style->start_cell + style->num_cells];
                         cell->x       =  curr_cell->x;
                         cell->area    = -curr_cell->area;
                         cell->cover   = -curr_cell->cover;
-                        style->last_x =  curr_cell->x;
                         style->num_cells++;
                     }
                 }
+
+                // Sort each style's cells by x and merge the ones that
+                // share a pixel.
+                for(i = 1; i < m_ast.size(); i++)
+                {
+                    style_info& st = m_styles[m_ast[i]];
+                    range_adaptor<pod_vector<cell_info> > ra(m_cells, st.start_cell, st.num_cells);
+                    if(!dense) quick_sort(ra, cell_x_less);
+                    unsigned n = 0;
+                    for(unsigned k = 1; k < st.num_cells; k++)
+                    {
+                        if(ra[k].x == ra[n].x)
+                        {
+                            ra[n].area  += ra[k].area;
+                            ra[n].cover += ra[k].cover;
+                        }
+                        else
+                        {
+                            ra[++n] = ra[k];
+                        }
+                    }
+                    st.num_cells = n + 1;
+                }
             }
             if(m_ast.size() > 1) break;
             ++m_scan_y;
@@ -619,7 +680,7 @@ namespace agg
     template<class Clip> 
     AGG_INLINE bool rasterizer_compound_aa<Clip>::navigate_scanline(int y)
     {
-        m_outline.sort_cells();
+        m_outline.sort_cells(false);
         if(m_outline.total_cells() == 0) 
         {
             return false;
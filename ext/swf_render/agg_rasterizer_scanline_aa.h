@@ -163,6 +163,10 @@ namespace agg
         void reset(); 
         void reset_clipping();
         void clip_box(double x1, double y1, double x2, double y2);
+        // See rasterizer_cells_aa::window(). Unlike clip_box() this leaves
+        // the coverage inside the window exactly as without it.
+        void cell_window(int x1, int y1, int x2, int y2) { m_outline.window(x1, y1, x2, y2); }
+        void reset_cell_window() { m_outline.reset_window(); }
         void filling_rule(filling_rule_e filling_rule);
         void auto_close(bool flag) { m_auto_close = flag; }
 
@@ -519,7 +519,8 @@ namespace agg
                                    ScanlineBin& sl_bin,
                                    BaseRenderer& ren,
                                    SpanAllocator& alloc,
-                                   StyleHandler& sh)
+                                   StyleHandler& sh,
+                                   unsigned num_overlays = 0)
     {
         if(ras.rewind_scanlines())
         {
@@ -538,6 +539,13 @@ namespace agg
             bool     solid;
             while((num_styles = ras.sweep_styles()) > 0)
             {
+                // Overlay styles are the lowest, so they come last. They are
+                // painted one at a time over what the other styles produce.
+                unsigned num_all = num_styles;
+                while(num_styles && ras.style(num_styles - 1) < num_overlays)
+                {
+                    --num_styles;
+                }
 
                 typename ScanlineAA::const_iterator span_aa;
                 if(num_styles == 1)
@@ -580,7 +588,7 @@ namespace agg
                         }
                     }
                 }
-                else
+                else if(num_styles > 1)
                 {
                     if(ras.sweep_scanline(sl_bin, -1))
                     {
@@ -681,6 +689,14 @@ namespace agg
                         }
                     } // if(ras.sweep_scanline(sl_bin, -1))
                 } // if(num_styles == 1) ... else
+
+                for(unsigned i = num_styles; i < num_all; i++)
+                {
+                    if(ras.sweep_scanline(sl_aa, i))
+                    {
+                        render_scanline_aa_solid(sl_aa, ren, sh.color(ras.style(i)));
+                    }
+                }
             } // while((num_styles = ras.sweep_styles()) > 0)
         } // if(ras.rewind_scanlines())
     }
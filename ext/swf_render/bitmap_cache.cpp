@@ -0,0 +1,105 @@
+#include "bitmap_cache.h"
+
+#include <pthread.h>
+
+#include <list>
+#include <map>
+#include <set>
+
+#include "thread_pool.h"
+
+namespace {
+
+// 64MB of pixels.
+const size_t kMaxCachedPixels = 1 << 24;
+
+struct BitmapKey {
+  BitmapKey(const DisplayTree* node, const std::vector<double>& signature)
+    : node(node), signature(signature) {}
+  bool operator<(const BitmapKey& other) const {
+    if (node != other.node) return node < other.node;
+    return signature < other.signature;
+  }
+  const DisplayTree* node;
+  std::vector<double> signature;
+};
+
+struct BitmapEntry {
+  CachedBitmap* bitmap;
+  // Position in recently_used.
+  std::list<const BitmapKey*>::iterator use;
+};
+
+typedef std::map<BitmapKey, BitmapEntry> BitmapMap;
+
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+BitmapMap cache;
+// Keys of cache, most recently used first.
+std::list<const BitmapKey*> recently_used;
+size_t cached_pixels = 0;
+
+}  // namespace
+
+const CachedBitmap* BitmapCache::Acquire(
+    const DisplayTree* node,
+    const std::vector<double>& signature) {
+  ScopedLock lock(&cache_mutex);
+  BitmapMap::iterator it = cache.find(BitmapKey(node, signature));
+  if (it == cache.end()) return NULL;
+  recently_used.splice(recently_used.begin(), recently_used, it->second.use);
+  it->second.bitmap->m_shared.refs++;
+  return it->second.bitmap;
+}
+
+const CachedBitmap* BitmapCache::Insert(
+    const DisplayTree* node,
+    const std::vector<double>& signature,
+    CachedBitmap* bitmap) {
+  const BitmapKey key(node, signature);
+  ScopedLock lock(&cache_mutex);
+  BitmapMap::iterator it = cache.find(key);
+  if (it != cache.end()) {
+    delete bitmap;
+    it->second.bitmap->m_shared.refs++;
+    return it->second.bitmap;
+  }
+  bitmap->m_shared.refs = 1;
+  it = cache.insert(std::make_pair(key, BitmapEntry())).first;
+  it->second.bitmap = bitmap;
+  recently_used.push_front(&it->first);
+  it->second.use = recently_used.begin();
+  cached_pixels += bitmap->width * bitmap->height;
+  while (cached_pixels > kMaxCachedPixels && recently_used.size() > 1) {
+    BitmapMap::iterator oldest = cache.find(*recently_used.back());
+    recently_used.pop_back();
+    CachedBitmap* evicted = oldest->second.bitmap;
+    cached_pixels -= evicted->width * evicted->height;
+    cache.erase(oldest);
+    if (evicted->m_shared.Evict()) delete evicted;
+  }
+  return bitmap;
+}
+
+void BitmapCache::Purge(const DisplayTree& root) {
+  const std::set<const DisplayTree*> nodes(root.nodes.begin(),
+                                           root.nodes.end());
+  ScopedLock lock(&cache_mutex);
+  BitmapMap::iterator it = cache.begin();
+  while (it != cache.end()) {
+    if (!nodes.count(it->first.node)) {
+      ++it;
+      continue;
+    }
+    CachedBitmap* purged = it->second.bitmap;
+    cached_pixels -= purged->width * purged->height;
+    recently_used.erase(it->second.use);
+    cache.erase(it++);
+    if (purged->m_shared.Evict()) delete purged;
+  }
+}
+
+void BitmapCache::Release(const CachedBitmap* bitmap) {
+  CachedBitmap* entry = const_cast<CachedBitmap*>(bitmap);
+  ScopedLock lock(&cache_mutex);
+  if (entry->m_shared.Release()) delete entry;
+}
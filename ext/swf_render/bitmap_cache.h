@@ -0,0 +1,57 @@
+#ifndef _BITMAPCACHE_H
+#define _BITMAPCACHE_H
+
+#include <vector>
+
+#include "display_tree.h"
+#include "thread_pool.h"
+
+// The painted and filtered pixels of a cacheAsBitmap subtree, in plain
+// RGBA.
+class CachedBitmap {
+public:
+  CachedBitmap(int width, int height)
+    : width(width),
+      height(height),
+      pixels(width * height * 4, 0) {}
+
+  const int width;
+  const int height;
+  std::vector<unsigned char> pixels;
+
+private:
+  friend class BitmapCache;
+
+  SharedEntry m_shared;
+};
+
+// Process wide cache of the bitmaps of cacheAsBitmap subtrees, as Flash
+// keeps them: a subtree drawn again with the same content is blitted
+// rather than rasterized. Entries are keyed by the subtree's node and a
+// signature of everything that decides its pixels (its shapes, their
+// transforms up to a whole pixel translation, their colors). Entries are
+// purged along with the document their nodes belong to. The least
+// recently used bitmaps are dropped once the cache holds too many pixels.
+class BitmapCache {
+public:
+  // Returns the bitmap stored for node under signature, or NULL. The
+  // caller must hand a non-NULL result back to Release.
+  static const CachedBitmap* Acquire(const DisplayTree* node,
+                                     const std::vector<double>& signature);
+
+  // Stores bitmap, which the cache takes ownership of. If another thread
+  // stored the same entry first, bitmap is deleted and that entry is
+  // returned instead. Either way the result must be handed back to
+  // Release.
+  static const CachedBitmap* Insert(const DisplayTree* node,
+                                    const std::vector<double>& signature,
+                                    CachedBitmap* bitmap);
+
+  static void Release(const CachedBitmap* bitmap);
+
+  // Drops every entry for a node of the tree under root, which is about
+  // to be freed. Entries still in use are deleted by their last Release.
+  static void Purge(const DisplayTree& root);
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "clip_mask.h"
+
+#include <algorithm>
+#include <vector>
+
+ClipMask::ClipMask(int clip_width, int clip_height, const agg::rect_i& window)
+  : m_window(window) {
+  m_rasc.clip_box(0, 0, clip_width, clip_height);
+  m_rasc.cell_window(window.x1, window.y1, window.x2, window.y2);
+  m_rasc.layer_order(agg::layer_direct);
+}
+
+void ClipMask::AddShape(const Shape& shape, const Matrix& transform) {
+  agg::compound_shape compound;
+  compound.set_shape(&shape);
+  compound.m_affine = transform;
+  while (compound.read_next()) {
+    Matrix identity;
+    agg::conv_transform<agg::compound_shape> path(compound, identity);
+    // Every fill is the same style, so edges between two fills cancel
+    // and overlapping fills add up to full coverage.
+    for (int i = 0; i < compound.paths(); i++) {
+      const int left = compound.style(i).left_fill >= 0 ? 0 : -1;
+      const int right = compound.style(i).right_fill >= 0 ? 0 : -1;
+      if (left < 0 && right < 0) continue;
+      m_rasc.styles(left, right);
+      m_rasc.add_path(path, compound.style(i).path_id);
+    }
+  }
+}
+
+void ClipMask::Blend(const pixfmt& layer, renderer_base& ren_base) {
+  if (!m_rasc.rewind_scanlines()) return;
+  scanline sl;
+  sl.reset(m_rasc.min_x(), m_rasc.max_x());
+  std::vector<Color> colors;
+  while (m_rasc.sweep_styles() > 0) {
+    if (!m_rasc.sweep_scanline(sl, 0)) continue;
+    const int y = sl.y();
+    if (y < m_window.y1 || y > m_window.y2) continue;
+    scanline::const_iterator span = sl.begin();
+    for (unsigned n = sl.num_spans(); n > 0; n--, ++span) {
+      const int x1 = std::max<int>(span->x, m_window.x1);
+      const int x2 = std::min<int>(span->x + span->len - 1, m_window.x2);
+      if (x1 > x2) continue;
+      colors.resize(x2 - x1 + 1);
+      for (int x = x1; x <= x2; x++) {
+        colors[x - x1] = layer.pixel(x, y);
+      }
+      ren_base.blend_color_hspan(x1, y, x2 - x1 + 1, &colors[0],
+                                 span->covers + (x1 - span->x));
+    }
+  }
+}
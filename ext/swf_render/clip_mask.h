@@ -0,0 +1,32 @@
+#ifndef _CLIP_MASK_H
+#define _CLIP_MASK_H
+
+#include "agg_rasterizer_compound_aa.h"
+
+#include "display_tree.h"
+
+// The area a clipping placement lets the placements it masks show
+// through: the union of the fills of its shapes. As in Flash, strokes,
+// colors and gradients play no part. Only the rasterizer cells reaching
+// the window are kept, so the cost follows the mask's outline within the
+// part of the frame being painted, not the size of the frame.
+class ClipMask {
+public:
+  // The mask is rasterized clipped to the clip_width x clip_height frame,
+  // as DisplayTree::RenderShape does, so a window gets exactly the
+  // coverage a full render would.
+  ClipMask(int clip_width, int clip_height, const agg::rect_i& window);
+
+  // Adds the fills of shape, drawn at transform.
+  void AddShape(const Shape& shape, const Matrix& transform);
+
+  // Blends the pixels of layer inside the window into ren_base, scaled by
+  // the mask's coverage.
+  void Blend(const pixfmt& layer, renderer_base& ren_base);
+
+private:
+  agg::rect_i m_window;
+  agg::rasterizer_compound_aa<agg::rasterizer_sl_clip_dbl> m_rasc;
+};
+
+#endif
@@ -1,21 +1,32 @@
 #include "display_tree.h"
+#include "hairlines.h"
+#include "render_list.h"
+#include "shape_coverage.h"
+#include "spec_program.h"
+#include "stroke_cache.h"
 #include <cstdlib>
 #include <stdio.h>
+#include <string.h>
 
 namespace {
 
 void BuildTree(
     const ParsedSWF& swf,
     const Sprite& sprite,
-    DisplayTree* tree) {
+    DisplayTree* tree,
+    DisplayTree* root) {
   for (std::vector<Placement>::const_iterator it =
          sprite.placements.begin(); it != sprite.placements.end(); ++it) {
     const Placement& placement = *it;
     DisplayTree* child = new DisplayTree();
     child->placement = &placement;
     child->name = placement.name;
+    child->name_hash = DisplayTree::HashName(
+        placement.name.data(), placement.name.size());
+    child->index = root->nodes.size();
+    root->nodes.push_back(child);
     if (const Sprite* sprite = swf.SpriteByCharacterId(placement.character_id)) {
-      BuildTree(swf, *sprite, child);
+      BuildTree(swf, *sprite, child, root);
     }
     else if (const Shape* shape = swf.ShapeByCharacterId(placement.character_id)) {
       child->shape = shape;
@@ -34,6 +45,7 @@ bool compound_shape::read_next()
   if (m_record_index >= m_shape->records.size()) return false;
     m_path.remove_all();
     m_styles.clear();
+    m_strokes.clear();
     int last_move_x = 0;
     int last_move_y = 0;
     int last_fill0 = -1;
@@ -133,32 +145,45 @@ DisplayTree* DisplayTree::Build(
     const ParsedSWF& swf,
     const Sprite& sprite) {
   DisplayTree* tree = new DisplayTree();
-  BuildTree(swf, sprite, tree);
+  tree->nodes.push_back(tree);
+  BuildTree(swf, sprite, tree, tree);
   return tree;
 }
 
+DisplayTree::~DisplayTree() {
+  for (std::vector<DisplayTree*>::const_iterator it =
+         children.begin(); it != children.end(); ++it) {
+    delete *it;
+  }
+}
+
 void DisplayTree::GetBounds(
     const Matrix& transform,
+    const SpecOverlay* overlay,
     double* x_min_out,
     double* x_max_out,
     double* y_min_out,
     double* y_max_out) const {
-  if (!visible) return;
+  const SpecOverlay::NodeOverride* o = overlay ? overlay->Find(index) : NULL;
+  if (o && !o->visible) return;
   Matrix m(transform);
   if (placement) {
     m.premultiply(placement->matrix);
   }
-  m.premultiply(matrix);
+  if (o) {
+    m.premultiply(o->matrix);
+  }
   if (shape) {
     GetShapeBounds(*shape, m, x_min_out, x_max_out, y_min_out, y_max_out);
   }
   for (std::vector<DisplayTree*>::const_iterator it =
          children.begin(); it != children.end(); ++it) {
-    (*it)->GetBounds(m, x_min_out, x_max_out, y_min_out, y_max_out);
+    (*it)->GetBounds(m, overlay, x_min_out, x_max_out, y_min_out, y_max_out);
   }
 }
 
 void DisplayTree::GetNaturalSizeInPixels(
+    const SpecOverlay* overlay,
     int* width_out,
     int* height_out) const {
   double x1 = 0;
@@ -166,12 +191,13 @@ void DisplayTree::GetNaturalSizeInPixels(
   double y1 = 0;
   double y2 = 0;
   Matrix identity;
-  GetBounds(identity, &x1, &x2, &y1, &y2);
+  GetBounds(identity, overlay, &x1, &x2, &y1, &y2);
   *width_out = (int)((x2 - x1) / 20.0);
   *height_out = (int)((y2 - y1) / 20.0);
 }
 
-const ColorMatrix* DisplayTree::GetColorMatrix() const {
+const ColorMatrix* DisplayTree::GetColorMatrix(
+    const SpecOverlay::NodeOverride* node_override) const {
   if (placement) {
     for (std::vector<Filter>::const_iterator it =
            placement->filters.begin(); it != placement->filters.end(); ++it) {
@@ -180,11 +206,8 @@ const ColorMatrix* DisplayTree::GetColorMatrix() const {
       }
     }
   }
-  for (std::vector<Filter>::const_iterator it =
-         filters.begin(); it != filters.end(); ++it) {
-    if (it->filter_type == Filter::kFilterColorMatrix) {
-      return &it->color_matrix;
-    }
+  if (node_override && node_override->has_color) {
+    return &node_override->color_matrix;
   }
   return NULL;
 }
@@ -192,31 +215,65 @@ const ColorMatrix* DisplayTree::GetColorMatrix() const {
 int DisplayTree::Render(
     const Matrix& transform,
     const ColorMatrix* color_matrix,
+    const SpecOverlay* overlay,
     int clip_width,
     int clip_height,
     renderer_base& ren_base,
     renderer_scanline& ren) const {
+  RenderList list;
+  Flatten(transform, color_matrix, overlay, &list);
+  list.Render(0, list.size(), clip_width, clip_height, ren_base, ren);
+  return 0;
+}
 
-  if (!visible) return 0;
+void DisplayTree::Flatten(
+    const Matrix& transform,
+    const ColorMatrix* color_matrix,
+    const SpecOverlay* overlay,
+    RenderList* list) const {
+  const SpecOverlay::NodeOverride* o = overlay ? overlay->Find(index) : NULL;
+  if (o && !o->visible) return;
   Matrix m(transform);
   if (placement) {
     m.premultiply(placement->matrix);
   }
-  m.premultiply(matrix);
+  if (o) {
+    m.premultiply(o->matrix);
+  }
   const ColorMatrix* color_m = color_matrix;
-  if (const ColorMatrix* cm = GetColorMatrix()) {
+  if (const ColorMatrix* cm = GetColorMatrix(o)) {
     // We don't currently support multiplying color matrices.
     assert(color_m == NULL);
     color_m = cm;
   }
+  const bool layered =
+      placement && list->PushLayer(this, *placement, m);
   if (shape) {
-    RenderShape(*shape, m, color_m, clip_width, clip_height, ren_base, ren);
+    list->Add(this, m, color_m);
   }
+  // Depths up to which the open masks clip their siblings, innermost
+  // last.
+  std::vector<int> clip_depths;
   for (std::vector<DisplayTree*>::const_iterator it =
          children.begin(); it != children.end(); ++it) {
-    (*it)->Render(m, color_m, clip_width, clip_height, ren_base, ren);
+    const Placement* p = (*it)->placement;
+    while (!clip_depths.empty() && (!p || p->depth > clip_depths.back())) {
+      list->PopLayer();
+      clip_depths.pop_back();
+    }
+    if (p && p->clip_depth > 0) {
+      list->PushMask(*it, m, overlay);
+      clip_depths.push_back(p->clip_depth);
+      continue;
+    }
+    (*it)->Flatten(m, color_m, overlay, list);
+  }
+  for (unsigned i = 0; i < clip_depths.size(); i++) {
+    list->PopLayer();
+  }
+  if (layered) {
+    list->PopLayer();
   }
-  return 0;
 }
 
 void DisplayTree::GetShapeBounds(
@@ -259,266 +316,255 @@ int DisplayTree::RenderShape(
     const ColorMatrix* color_matrix,
     int clip_width, int clip_height,
     renderer_base& ren_base,
-    renderer_scanline& ren) {
+    renderer_scanline& ren,
+    ShapeCoverage* coverage) {
+  // When the renderer is clipped to part of the frame (a tile or a dirty
+  // rectangle), the rasterizers only keep the cells that reach it. Their
+  // clip box stays the whole frame, so the pixels that are painted come
+  // out exactly as in a full render.
+  const bool windowed = ren_base.xmin() > 0 || ren_base.ymin() > 0 ||
+      ren_base.xmax() < clip_width - 1 || ren_base.ymax() < clip_height - 1;
+  // Stroked outlines come from the cache when this shape was stroked at
+  // this transform before; otherwise they are built here and stored.
+  const StrokedOutlines* cached = StrokeCache::Acquire(&shape, transform);
+  StrokedOutlines* built = cached ? NULL : new StrokedOutlines();
+  unsigned num_strokes = 0;
   agg::compound_shape  m_shape;
   m_shape.set_shape(&shape);
   m_shape.m_affine = transform;
   m_shape.m_color_matrix = color_matrix;
+  // One rasterizer serves every group, so its buffers are allocated once
+  // per shape rather than once per group.
+  agg::rasterizer_compound_aa<agg::rasterizer_sl_clip_dbl> rasc;
+  agg::scanline_u8 sl;
+  agg::scanline_bin sl_bin;
+  agg::span_allocator<Color> alloc;
   while (m_shape.read_next()) {
 //    m_shape.scale(clip_width, height);
-    agg::rasterizer_scanline_aa<agg::rasterizer_sl_clip_dbl> ras;
-    agg::rasterizer_compound_aa<agg::rasterizer_sl_clip_dbl> rasc;
-    agg::scanline_u8 sl;
-    agg::scanline_bin sl_bin;
     Matrix m_scale;
     agg::conv_transform<agg::compound_shape> shape(m_shape, m_scale);
     agg::conv_stroke<agg::conv_transform<agg::compound_shape> > stroke(shape);
-    agg::span_allocator<Color> alloc;
 //    m_shape.approximation_scale(m_scale.scale());
 //    printf("Filling shapes.\n");
     // Fill shape
     //----------------------
     rasc.clip_box(0, 0, clip_width, clip_height);
+    if (windowed) {
+      rasc.cell_window(ren_base.xmin(), ren_base.ymin(),
+                       ren_base.xmax(), ren_base.ymax());
+    }
     rasc.reset();
     rasc.layer_order(agg::layer_direct);
-    for(int i = 0; i < m_shape.paths(); i++)
-    {
-      rasc.styles(m_shape.style(i).left_fill,
-                  m_shape.style(i).right_fill);
-      rasc.add_path(shape, m_shape.style(i).path_id);
+
+    // Hairlines are drawn as lines after the rasterizer is done, so only
+    // those above every wider stroke of the group can be; any below one
+    // are stroked like the rest to keep the paint order.
+    int last_wide_stroke = -1;
+    for(int i = 0; i < m_shape.paths(); i++) {
+      if(m_shape.style(i).line >= 0) {
+        const LineStyle& style = m_shape.line_style(m_shape.style(i).line);
+        if (style.width > 1) last_wide_stroke = i;
+      }
     }
-    agg::render_scanlines_compound(rasc, sl, sl_bin, ren_base, alloc, m_shape);
 
-    ras.clip_box(0, 0, clip_width, clip_height);
+    // Strokes go into the same rasterizer as the fills, as styles that
+    // paint above them, so one sweep paints the whole group. Their
+    // outlines are collected first since the fill styles are numbered
+    // after them.
+    std::vector<unsigned> stroke_ids;
+    std::vector<int> hairline_paths;
     for(int i = 0; i < m_shape.paths(); i++) {
-      ras.reset();
       if(m_shape.style(i).line >= 0) {
         const LineStyle& style = m_shape.line_style(m_shape.style(i).line);
         if (style.width == 0) continue;
-        // Special handling for 'hairline' strokes that should be scale invariant.
-        const double width = style.width == 1 ? 
-            1.0 : (double)style.width * m_shape.m_affine.scale();
-        stroke.width(width);
-        switch (style.join_style) {
-          case LineStyle::kJoinBevel:
-            stroke.line_join(agg::bevel_join);
-            break;
-          case LineStyle::kJoinMiter:
-            stroke.line_join(agg::miter_join);
-            if (style.miter_limit_factor > 0) {
-              stroke.miter_limit(style.miter_limit_factor);
-            }
-            break;
-          case LineStyle::kJoinRound:  // Fall through
-          default:
-            stroke.line_join(agg::round_join);
-            break;
-        }
-        switch (style.start_cap_style) {
-          case LineStyle::kCapRound:
-            stroke.line_cap(agg::round_cap);
-            break;
-          case LineStyle::kCapSquare:
-            stroke.line_cap(agg::square_cap);
-            break;
-          case LineStyle::kCapNone:  // Fall through
-          default:
-            stroke.line_cap(agg::butt_cap);
-            break;
+        if (style.width == 1 && i > last_wide_stroke) {
+          hairline_paths.push_back(i);
+          continue;
         }
-        Color c = make_rgba(style.rgba);
-        if (color_matrix) {
-          color_matrix->transform(&c);
+        if (!cached) {
+          // Special handling for 'hairline' strokes that should be scale invariant.
+          const double width = style.width == 1 ? 
+              1.0 : (double)style.width * m_shape.m_affine.scale();
+          stroke.width(width);
+          switch (style.join_style) {
+            case LineStyle::kJoinBevel:
+              stroke.line_join(agg::bevel_join);
+              break;
+            case LineStyle::kJoinMiter:
+              stroke.line_join(agg::miter_join);
+              if (style.miter_limit_factor > 0) {
+                stroke.miter_limit(style.miter_limit_factor);
+              }
+              break;
+            case LineStyle::kJoinRound:  // Fall through
+            default:
+              stroke.line_join(agg::round_join);
+              break;
+          }
+          switch (style.start_cap_style) {
+            case LineStyle::kCapRound:
+              stroke.line_cap(agg::round_cap);
+              break;
+            case LineStyle::kCapSquare:
+              stroke.line_cap(agg::square_cap);
+              break;
+            case LineStyle::kCapNone:  // Fall through
+            default:
+              stroke.line_cap(agg::butt_cap);
+              break;
+          }
+          built->Add(stroke, m_shape.style(i).path_id);
         }
-        ren.color(c);
-        ras.add_path(stroke, m_shape.style(i).path_id);
-        agg::render_scanlines(ras, sl, ren);
+        stroke_ids.push_back(num_strokes++);
+        m_shape.m_strokes.push_back(&style);
+      }
+    }
+    for(int i = 0; i < m_shape.paths(); i++)
+    {
+      rasc.styles(m_shape.fill_style(m_shape.style(i).left_fill),
+                  m_shape.fill_style(m_shape.style(i).right_fill));
+      rasc.add_path(shape, m_shape.style(i).path_id);
+    }
+    if (!stroke_ids.empty()) {
+      const StrokedOutlines& outlines = cached ? *cached : *built;
+      agg::path_storage_reader<agg::path_storage> outline(outlines.paths());
+      for (unsigned k = 0; k < stroke_ids.size(); k++) {
+        rasc.styles(m_shape.stroke_style(k), -1);
+        rasc.add_path(outline, outlines.path_id(stroke_ids[k]));
       }
     }
+
+    // Strokes are blended onto the result of the fills one after another,
+    // as though each had been rendered on its own.
+    const unsigned num_overlays = m_shape.m_strokes.size();
+
+    ShapeCoverage::Pass* pass = coverage ?
+        coverage->AddPass(m_shape.m_fill_styles, m_shape.m_strokes) : NULL;
+    Hairlines group_hairlines;
+    Hairlines& hairlines = pass ? pass->hairlines : group_hairlines;
+    for (unsigned k = 0; k < hairline_paths.size(); k++) {
+      const agg::path_style& path = m_shape.style(hairline_paths[k]);
+      hairlines.Add(shape, path.path_id, &m_shape.line_style(path.line));
+    }
+    if (pass) {
+      pass->clip_width = clip_width;
+      pass->clip_height = clip_height;
+      agg::coverage_recorder<agg::rasterizer_compound_aa<agg::rasterizer_sl_clip_dbl> >
+          recorder(rasc, pass);
+      agg::render_scanlines_compound(
+          recorder, sl, sl_bin, ren_base, alloc, m_shape, num_overlays);
+    } else {
+      agg::render_scanlines_compound(
+          rasc, sl, sl_bin, ren_base, alloc, m_shape, num_overlays);
+    }
+    hairlines.Draw(color_matrix, clip_width, clip_height, ren_base);
+  }
+  if (cached) {
+    StrokeCache::Release(cached);
+  } else if (built->size() > 0) {
+    StrokeCache::Release(StrokeCache::Insert(&shape, transform, built));
+  } else {
+    delete built;
   }
   return 0;  
 }
 
 static const char kNewline = '\n';
-static const char kSingleQuote = '\'';
-static const char kFalse = 'f';
-static const char kTrue = 't';
-static const char kColon = ':';
 static const char kDot = '.';
-static const char kEquals = '=';
 
-enum SpecState {
-  kAtStart,
-  kOther
-};
+unsigned DisplayTree::HashName(const char* name, size_t length) {
+  // FNV-1a
+  unsigned hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+const DisplayTree* DisplayTree::ChildByName(const char* name) const {
+  const size_t length = strlen(name);
+  return ChildByName(name, length, HashName(name, length));
+}
 
-DisplayTree* DisplayTree::ChildByName(const char* name) {
+const DisplayTree* DisplayTree::ChildByName(
+    const char* name, size_t length, unsigned hash) const {
   for (std::vector<DisplayTree*>::const_iterator it =
          children.begin(); it != children.end(); ++it) {
-    DisplayTree* child = *it;
-    if (child->name == name) {
+    const DisplayTree* child = *it;
+    if (child->name_hash == hash &&
+        child->name.size() == length &&
+        memcmp(child->name.data(), name, length) == 0) {
       return child;
     }
   }
   return NULL;
 }
 
-DisplayTree* DisplayTree::DescendantByPath(const char* path) {
+const DisplayTree* DisplayTree::DescendantByPath(const char* path) const {
+  const DisplayTree* p = this;
   const char* c = path;
-  char name[200];
-  char* n = name;
-  DisplayTree* p = NULL;
-  while (*c) {
-    if (*c == kDot || *c == kNewline) {
-      *n = '\0';
-      p = ChildByName(name);
-      if (p == NULL) {
-        fprintf(stderr, "No child instance with name %s.", name);
-        return NULL;
-      } else {
-        return *c == kNewline ? p : p->DescendantByPath(c + 1);
-      }
-    } else {
-      *n = *c;
+  while (p) {
+    const char* start = c;
+    while (*c && *c != kDot && *c != kNewline) {
+      ++c;
+    }
+    const size_t length = c - start;
+    p = p->ChildByName(start, length, HashName(start, length));
+    if (p == NULL) {
+      fprintf(stderr, "No child instance with name %.*s.", (int)length, start);
+      return NULL;
+    }
+    if (*c != kDot) {
+      return p;
     }
-    ++n;
     ++c;
   }
   return NULL;
 }
 
-struct Modifier {
-  Modifier()
-    : sx(1.0),
-      sy(1.0),
-      r(0.0),
-      rgb(0),
-      a(1.0),
-      v(true),
-      has_color(false),
-      has_alpha(false){}
-  double sx;
-  double sy;
-  double r;
-  unsigned rgb;
-  double a;
-  bool v;
-  bool has_color;
-  bool has_alpha;
-};
-
-void DisplayTree::SetColor(unsigned r, unsigned g, unsigned b) {
-  Filter filter;
-  filter.filter_type = Filter::kFilterColorMatrix;
-  filter.color_matrix = ColorMatrix::WithColor(r, g, b);
-  filters.push_back(filter);
-}
+SpecOverlay::SpecOverlay(const DisplayTree& root)
+  : m_slots(root.nodes.size(), -1) {}
 
-void DisplayTree::SetColor(unsigned r, unsigned g, unsigned b, double alpha) {
-  Filter filter;
-  filter.filter_type = Filter::kFilterColorMatrix;
-  filter.color_matrix = ColorMatrix::WithColorAndAlpha(r, g, b, alpha);
-  filters.push_back(filter);
+// Only the first color set on a node takes effect.
+void SpecOverlay::SetColor(int node, unsigned r, unsigned g, unsigned b) {
+  NodeOverride* o = Get(node);
+  if (o->has_color) return;
+  o->has_color = true;
+  o->color_matrix = ColorMatrix::WithColor(r, g, b);
 }
 
-void ApplyModifier(const Modifier& mod, DisplayTree* target) {
-  if (mod.has_color) {
-    unsigned r = (mod.rgb >> 16) & 0xFF; 
-    unsigned g = (mod.rgb >> 8) & 0xFF;
-    unsigned b = (mod.rgb & 0xFF);
-    if (mod.has_alpha) {
-      target->SetColor(r, g, b, mod.a);
-    } else {
-      target->SetColor(r, g, b);
-    }
-  }
-  if (mod.r != 0) {
-    target->matrix.rotate(mod.r);
-  }
-  if (mod.sx != 1.0 || mod.sy != 1.0) {
-    target->matrix.scale(mod.sx, mod.sy);
-  }
-  target->visible = mod.v;
+void SpecOverlay::SetColor(
+    int node, unsigned r, unsigned g, unsigned b, double alpha) {
+  NodeOverride* o = Get(node);
+  if (o->has_color) return;
+  o->has_color = true;
+  o->color_matrix = ColorMatrix::WithColorAndAlpha(r, g, b, alpha);
 }
 
-void ParseProperty(const char* property, Modifier* modifier) {
-  const char* c = property;
-  char key[100];
-  char value[100];
-  char* n = key;
-  while (*c && *c != kNewline) {
-    if (*c == kEquals) {
-      *n = '\0';
-      n = value;
-    } else {
-      *n = *c;
-      ++n;
-    }
-    ++c;
-  }
-  *n = '\0';
-  if (strcmp(key, "v") == 0) {
-    modifier->v = value[0] == 't';
-  }
-  else if (strcmp(key, "c") == 0) {
-    char* v = value;
-    v += 3; // Go past '0x
-    char * p;
-    modifier->rgb = strtoul(v, &p, 16);
-    modifier->has_color = true;
-
-  } else if (strcmp(key, "s") == 0) {
-    char * p;
-    modifier->sx = strtod(value, &p);
-    modifier->sy = modifier->sx;
-
-  } else if (strcmp(key, "sx") == 0) {
-    char * p;
-    modifier->sx = strtod(value, &p);
-
-  } else if (strcmp(key, "sy") == 0) {
-    char * p;
-    modifier->sy = strtod(value, &p);
-
-  } else if (strcmp(key, "r") == 0) {
-    char * p;
-    modifier->r = strtod(value, &p);
-
-  } else if (strcmp(key, "a") == 0) {
-    char * p;
-    modifier->a = strtod(value, &p);
-    modifier->has_alpha = true;
+int SpecOverlay::FirstOverriddenNode() const {
+  for (int i = 0; i < m_slots.size(); i++) {
+    if (m_slots[i] >= 0) return i;
   }
+  return -1;
 }
 
-void DisplayTree::ApplySpec(const char* spec) {
-  SpecState state = kAtStart;
-  DisplayTree* target = NULL;
-  Modifier modifier;
-  const char* c = spec;
-  int num_props = 0;
-  while (*c) {
-    if (state == kAtStart) {
-      if (*c == kColon) {
-        if (target && num_props) {
-          ApplyModifier(modifier, target);
-        }
-        target = DescendantByPath(c + 1);
-        modifier = Modifier();
-        num_props = 0;
-      } else if (target) {
-        ParseProperty(c, &modifier);
-        num_props++;
-      }
-      state = kOther;
-    }
-    if (*c == kNewline) {
-      state = kAtStart;
-    }
-    ++c;
-  }
-  if (target && num_props) {
-    ApplyModifier(modifier, target);
+bool SpecOverlay::SameGeometry(const SpecOverlay& other) const {
+  if (m_slots.size() != other.m_slots.size()) return false;
+  static const NodeOverride kNone;
+  for (int i = 0; i < m_slots.size(); i++) {
+    const NodeOverride* a = Find(i);
+    const NodeOverride* b = other.Find(i);
+    if (!a && !b) continue;
+    if (!a) a = &kNone;
+    if (!b) b = &kNone;
+    if (a->visible != b->visible) return false;
+    if (a->visible && !a->matrix.is_equal(b->matrix, 0.0)) return false;
   }
+  return true;
 }
 
+void DisplayTree::ApplySpec(const char* spec, SpecOverlay* overlay) const {
+  SpecProgram program(*this, spec);
+  program.Apply(overlay, NULL);
+}
@@ -64,23 +64,38 @@ namespace agg
           return (*m_line_styles)[line_style_index];
         }
 
-        bool is_solid(unsigned fill_style_index) const
+        // Rasterizer style of the index'th fill style and of the index'th
+        // stroke of the current group. layer_direct paints lower styles
+        // over higher ones, so strokes take the lowest styles, last stroke
+        // first, and the fills follow.
+        int fill_style(int index) const
         {
-          const FillStyle& fill = (*m_fill_styles)[fill_style_index];
-          switch (fill.type) {
-          case FillStyle::kGradientLinear:
-          case FillStyle::kGradientRadial:
-          case FillStyle::kGradientFocal:
-            return false;
-          default: return true;
-          }
+          return index < 0 ? -1 : index + int(m_strokes.size());
+        }
+
+        unsigned stroke_style(unsigned index) const
+        {
+          return m_strokes.size() - 1 - index;
+        }
+
+        bool is_solid(unsigned style) const
+        {
+          if (style < m_strokes.size()) return true;
+          return !(*m_fill_styles)[style - m_strokes.size()].IsGradient();
         }
 
         // Just returns a color
         //---------------------------------------------
-        Color color(unsigned fill_style_index) const
+        Color color(unsigned style) const
         {
-          const FillStyle& fill = (*m_fill_styles)[fill_style_index];
+          if (style < m_strokes.size()) {
+            Color c = make_rgba(m_strokes[m_strokes.size() - 1 - style]->rgba);
+            if (m_color_matrix) {
+              m_color_matrix->transform(&c);
+            }
+            return c;
+          }
+          const FillStyle& fill = (*m_fill_styles)[style - m_strokes.size()];
           if (fill.type == FillStyle::kSolid) {
             Color c = make_rgba(fill.rgba);
             if (m_color_matrix) {
@@ -100,7 +115,7 @@ namespace agg
         // isn't used here.
         //---------------------------------------------
         void generate_span(Color* span, int x, int y, unsigned len, unsigned style) {
-          const FillStyle& fill_style = (*m_fill_styles)[style];
+          const FillStyle& fill_style = (*m_fill_styles)[style - m_strokes.size()];
           // The initial gradient square is centered at (0,0),
           // and extends from (-16384,-16384) to (16384,16384).
           // Transform each point *back* to this box and then
@@ -163,13 +178,18 @@ namespace agg
 
         const std::vector<FillStyle>* m_fill_styles;
         const std::vector<LineStyle>* m_line_styles;
+        // Line styles of the strokes rasterized with the current group's
+        // fills, in paint order.
+        std::vector<const LineStyle*>             m_strokes;
         trans_affine                              m_affine;
         const ColorMatrix*                              m_color_matrix;
 
     private:
-        path_storage                              m_path;
-        conv_curve<path_storage>                  m_curve;
-        conv_transform<conv_curve<path_storage> > m_trans;
+        // Outlines of the current group in twips. They are only converted
+        // to doubles on their way to the transform.
+        path_storage_int32                              m_path;
+        conv_curve<path_storage_int32>                  m_curve;
+        conv_transform<conv_curve<path_storage_int32> > m_trans;
         std::vector<path_style>                   m_styles;
         double                                    m_x1, m_y1, m_x2, m_y2;
         int m_record_index;
@@ -180,59 +200,133 @@ namespace agg
 }  // namespace agg
 
 
+class DisplayTree;
+class RenderList;
+class ShapeCoverage;
+
+// Per-node overrides produced by applying a spec to a display tree. The
+// tree itself is never modified, so one tree can be shared by any number
+// of requests, each rendering it through its own overlay. Nodes without
+// an override render as built.
+class SpecOverlay {
+public:
+  struct NodeOverride {
+    NodeOverride() : has_color(false), visible(true) {}
+    // Applied after the placement matrix.
+    Matrix matrix;
+    bool has_color;
+    ColorMatrix color_matrix;
+    bool visible;
+  };
+
+  explicit SpecOverlay(const DisplayTree& root);
+
+  const NodeOverride* Find(int node) const {
+    const int slot = m_slots[node];
+    return slot < 0 ? NULL : &m_overrides[slot];
+  }
+
+  // Returns the override for node, adding one if needed.
+  NodeOverride* Get(int node) {
+    if (m_slots[node] < 0) {
+      m_slots[node] = m_overrides.size();
+      m_overrides.push_back(NodeOverride());
+    }
+    return &m_overrides[m_slots[node]];
+  }
+
+  void SetColor(int node, unsigned r, unsigned g, unsigned b);
+  void SetColor(int node, unsigned r, unsigned g, unsigned b, double alpha);
+
+  // Smallest node index with an override, or -1 if there are none.
+  // Everything painted before that node is the same as without the
+  // overlay.
+  int FirstOverriddenNode() const;
+
+  // True if both overlays hide the same nodes and move them the same
+  // way, so that they produce the same bounds and transforms.
+  bool SameGeometry(const SpecOverlay& other) const;
+
+private:
+  std::vector<int> m_slots;
+  std::vector<NodeOverride> m_overrides;
+};
+
+// The display list of a sprite, built once per (document, class) and
+// immutable afterwards. Spec modifications live in a SpecOverlay.
 class DisplayTree {
 public:
   DisplayTree() 
     : placement(NULL),
       shape(NULL),
-      visible(true) {}
+      index(0),
+      name_hash(0) {}
+
+  ~DisplayTree();
 
   static DisplayTree* Build(
       const ParsedSWF& swf,
       const Sprite& sprite);
 
-  // Apply a sequence of modification commands to
-  // the display tree. A poor man's Actionscript.
-  void ApplySpec(const char* spec);
+  // Apply a sequence of modification commands to the display
+  // tree, recording them in overlay. A poor man's Actionscript.
+  void ApplySpec(const char* spec, SpecOverlay* overlay) const;
 
   // Returns the child who's instance name is name, or
   // NULL if no such child exists.
-  DisplayTree* ChildByName(const char* name);
+  const DisplayTree* ChildByName(const char* name) const;
+  const DisplayTree* ChildByName(
+      const char* name, size_t length, unsigned hash) const;
 
   // Returns the descendent denoted by the chain of instance names
-  // name(.name)*. Returns NULL if no such descendent exists.
-  DisplayTree* DescendantByPath(const char* path);
+  // name(.name)*, terminated by a newline or the end of the string.
+  // Returns NULL if no such descendent exists.
+  const DisplayTree* DescendantByPath(const char* path) const;
 
-  const ColorMatrix* GetColorMatrix() const;
+  // Hash of an instance name, as stored in name_hash.
+  static unsigned HashName(const char* name, size_t length);
 
-  void SetColor(unsigned r, unsigned g, unsigned b);
-  void SetColor(unsigned r, unsigned g, unsigned b, double alpha);
+  const ColorMatrix* GetColorMatrix(
+      const SpecOverlay::NodeOverride* node_override) const;
 
+  // overlay may be NULL here and below.
   void GetBounds(
       const Matrix& transform,
+      const SpecOverlay* overlay,
       double* x_min_out,
       double* x_max_out,
       double* y_min_out,
       double* y_max_out) const;
 
   void GetNaturalSizeInPixels(
+      const SpecOverlay* overlay,
       int* width,
       int* height) const;
 
   int Render(const Matrix& transform,
              const ColorMatrix* color_matrix,
+             const SpecOverlay* overlay,
              int clip_width,
              int clip_height,
              renderer_base& ren_base,
              renderer_scanline& ren) const;
 
+  // Appends the visible shapes of this subtree to list in paint order.
+  void Flatten(const Matrix& transform,
+               const ColorMatrix* color_matrix,
+               const SpecOverlay* overlay,
+               RenderList* list) const;
+
+  // If coverage is given, the coverage of every pass is recorded in it
+  // so that the shape can be replayed in other colors.
   static int RenderShape(
       const Shape& shape,
       const Matrix& transform,
       const ColorMatrix* color_matrix,
       int clip_width, int clip_height,
       renderer_base& ren_base,
-      renderer_scanline& ren);
+      renderer_scanline& ren,
+      ShapeCoverage* coverage = NULL);
 
   static void GetShapeBounds(
       const Shape& shape,
@@ -244,11 +338,14 @@ public:
 
   const Placement* placement;
   const Shape* shape;
-  Matrix matrix;
   std::vector<DisplayTree*> children;
-  std::vector<Filter> filters;
   std::string name;
-  bool visible;
+
+  // Position of this node in a preorder walk from the root.
+  int index;
+  unsigned name_hash;
+  // Every node of the tree, by index. Only populated on the root.
+  std::vector<const DisplayTree*> nodes;
 };
 
 #endif
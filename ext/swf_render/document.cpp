@@ -0,0 +1,132 @@
+#include "document.h"
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <stdio.h>
+
+#include <list>
+
+#include "bitmap_cache.h"
+#include "display_tree.h"
+#include "stroke_cache.h"
+#include "thread_pool.h"
+#include "tiny_swfparser.h"
+
+namespace {
+
+// Most documents kept in the cache, in use or not.
+const size_t kMaxCachedDocuments = 32;
+
+struct DocumentEntry {
+  Document* document;
+  // Position in recently_opened.
+  std::list<const std::string*>::iterator use;
+};
+
+typedef std::map<std::string, DocumentEntry> DocumentMap;
+
+// Guards the document cache, every document's references and every
+// document's tree map. Only lookups and builds take the lock; rendering
+// reads the immutable results, and files are parsed without it.
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+DocumentMap document_cache;
+// Keys of document_cache, most recently opened first.
+std::list<const std::string*> recently_opened;
+
+}  // namespace
+
+const Document* Document::Open(const char* filename) {
+  struct stat st;
+  if (stat(filename, &st) != 0) return NULL;
+#ifdef __APPLE__
+  const struct timespec& mtime = st.st_mtimespec;
+#else
+  const struct timespec& mtime = st.st_mtim;
+#endif
+  char stamp[64];
+  snprintf(stamp, sizeof(stamp), "|%ld.%09ld|%ld",
+           (long)mtime.tv_sec, (long)mtime.tv_nsec, (long)st.st_size);
+  const std::string key = std::string(filename) + stamp;
+
+  {
+    ScopedLock lock(&cache_mutex);
+    DocumentMap::iterator it = document_cache.find(key);
+    if (it != document_cache.end()) {
+      recently_opened.splice(recently_opened.begin(), recently_opened,
+                             it->second.use);
+      it->second.document->m_shared.refs++;
+      return it->second.document;
+    }
+  }
+
+  TinySWFParser parser;
+  ParsedSWF* swf = parser.parse(filename);
+  if (!swf) return NULL;
+  Document* document = new Document(swf);
+  // Dropped documents that nobody holds, deleted once the lock is let go.
+  std::list<Document*> unused;
+  {
+    ScopedLock lock(&cache_mutex);
+    DocumentMap::iterator it = document_cache.find(key);
+    if (it != document_cache.end()) {
+      // Another thread parsed the same file meanwhile.
+      unused.push_back(document);
+      document = it->second.document;
+      recently_opened.splice(recently_opened.begin(), recently_opened,
+                             it->second.use);
+    } else {
+      it = document_cache.insert(std::make_pair(key, DocumentEntry())).first;
+      it->second.document = document;
+      recently_opened.push_front(&it->first);
+      it->second.use = recently_opened.begin();
+      while (recently_opened.size() > kMaxCachedDocuments) {
+        DocumentMap::iterator oldest = document_cache.find(*recently_opened.back());
+        recently_opened.pop_back();
+        Document* evicted = oldest->second.document;
+        document_cache.erase(oldest);
+        if (evicted->m_shared.Evict()) unused.push_back(evicted);
+      }
+    }
+    document->m_shared.refs++;
+  }
+  for (std::list<Document*>::iterator it = unused.begin();
+       it != unused.end(); ++it) {
+    delete *it;
+  }
+  return document;
+}
+
+void Document::Release(const Document* document) {
+  Document* entry = const_cast<Document*>(document);
+  {
+    ScopedLock lock(&cache_mutex);
+    if (!entry->m_shared.Release()) return;
+  }
+  delete entry;
+}
+
+Document::~Document() {
+  for (std::map<std::string, const DisplayTree*>::const_iterator it =
+           m_trees.begin(); it != m_trees.end(); ++it) {
+    BitmapCache::Purge(*it->second);
+    delete it->second;
+  }
+  StrokeCache::Purge(m_swf->shapes);
+  delete m_swf;
+}
+
+const DisplayTree* Document::TreeForClass(const char* class_name) const {
+  ScopedLock lock(&cache_mutex);
+  std::map<std::string, const DisplayTree*>::const_iterator it =
+      m_trees.find(class_name);
+  if (it != m_trees.end()) {
+    return it->second;
+  }
+  // Misses aren't stored, as class names come from callers.
+  const Sprite* sprite = m_swf->SpriteByClassName(class_name);
+  if (!sprite) return NULL;
+  const DisplayTree* tree = DisplayTree::Build(*m_swf, *sprite);
+  m_trees[class_name] = tree;
+  return tree;
+}
@@ -0,0 +1,68 @@
+#ifndef _DOCUMENT_H
+#define _DOCUMENT_H
+
+#include <map>
+#include <string>
+
+#include "thread_pool.h"
+
+class DisplayTree;
+class ParsedSWF;
+
+// A parsed SWF together with the display trees built from its classes.
+// Documents are cached and both they and their trees are immutable once
+// built, so any number of requests and threads can share them without
+// copying or locking. Each user holds a reference; a document dropped
+// from the cache is freed when the last one is released.
+class Document {
+public:
+  // Returns the document for filename, parsing the file the first time it
+  // is seen. Entries are keyed by path, modification time and size, so an
+  // updated file is parsed again. The least recently opened documents are
+  // dropped once the cache holds too many. Returns NULL if the file can't
+  // be parsed; otherwise the caller must hand the result back to Release.
+  static const Document* Open(const char* filename);
+
+  static void Release(const Document* document);
+
+  // Returns the tree for class_name, building it the first time it is
+  // asked for. Returns NULL if the document has no such class. The tree
+  // lives as long as the document.
+  const DisplayTree* TreeForClass(const char* class_name) const;
+
+  const ParsedSWF& swf() const { return *m_swf; }
+
+private:
+  explicit Document(ParsedSWF* swf)
+    : m_swf(swf) {}
+  // Also drops whatever the stroke and bitmap caches hold for the
+  // document's shapes and nodes, whose addresses may be reused.
+  ~Document();
+
+  ParsedSWF* m_swf;
+  mutable std::map<std::string, const DisplayTree*> m_trees;
+  SharedEntry m_shared;
+};
+
+// Holds a reference to the document for filename while in scope.
+class ScopedDocument {
+public:
+  explicit ScopedDocument(const char* filename)
+    : m_document(Document::Open(filename)) {}
+  ~ScopedDocument() {
+    if (m_document) Document::Release(m_document);
+  }
+
+  // Returns NULL if the file couldn't be parsed or has no such class.
+  const DisplayTree* TreeForClass(const char* class_name) const {
+    return m_document ? m_document->TreeForClass(class_name) : NULL;
+  }
+
+private:
+  ScopedDocument(const ScopedDocument&);
+  void operator=(const ScopedDocument&);
+
+  const Document* m_document;
+};
+
+#endif
@@ -11,5 +11,6 @@ require 'mkmf'
 #  Dir.glob("#{srcdir}/third_party/lodepng/*.cpp")).collect{|cpp| cpp.gsub(".cpp", ".o")}
 
 $CPPFLAGS += "-O3 -Wno-unused-value "
+have_library('pthread')
 
 create_makefile "swf_render"
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <map>
 #include <algorithm>
@@ -46,28 +47,23 @@
 #include "agg_bounding_rect.h"
 #include "agg_color_gray.h"
 #include "lodepng.h"
+#include "image_encoder.h"
+#include "png_encoder.h"
 
 #include "display_tree.h"
+#include "document.h"
+#include "render_list.h"
+#include "render_session.h"
+#include "shape_coverage.h"
+#include "spec_program.h"
+#include "thread_pool.h"
 #include "tiny_common.h"
 #include "tiny_swfparser.h"
 #include "utils.h"
 
-DisplayTree* create_display_tree(const RunConfig& c) {
-  TinySWFParser parser;
-  ParsedSWF* swf = parser.parse(c.input_swf.c_str());
-  assert(swf);
-  if (const Sprite* sprite = swf->SpriteByClassName(c.class_name.c_str())) {
-    DisplayTree* tree = DisplayTree::Build(*swf, *sprite);
-    if (c.spec.size()) {
-      tree->ApplySpec(c.spec.c_str());
-    }
-    return tree;
-  }
-  return NULL;
-}
-
 Matrix create_view_matrix(
     const DisplayTree& tree,
+    const SpecOverlay* overlay,
     int width,
     int height,
     int pad) {
@@ -77,7 +73,7 @@ Matrix create_view_matrix(
   double y1 = 0;
   double y2 = 0;
   Matrix identity;
-  tree.GetBounds(identity, &x1, &x2, &y1, &y2);
+  tree.GetBounds(identity, overlay, &x1, &x2, &y1, &y2);
 
   agg::trans_viewport vp;
   vp.preserve_aspect_ratio(0.5, 0.5, agg::aspect_ratio_meet);
@@ -89,8 +85,47 @@ Matrix create_view_matrix(
   return vp.to_affine();
 }
 
+// Renders bigger than one tile are split into tiles that are rasterized
+// in parallel.
+static const int kTileSize = 256;
+
+namespace {
+
+struct TileJob {
+  const RenderList* list;
+  int width;
+  int height;
+  int columns;
+  // Row of tiles that tile 0 is in.
+  int first_row;
+  // Addressed in frame coordinates, but only needs to hold the rows of
+  // the tiles rendered.
+  unsigned char* buf;
+};
+
+// Paints the shapes that reach tile t, clipped to it. Tiles don't
+// overlap, so they can share the buffer.
+void render_tile(int t, void* context) {
+  const TileJob* job = static_cast<const TileJob*>(context);
+  const int x1 = (t % job->columns) * kTileSize;
+  const int y1 = (job->first_row + t / job->columns) * kTileSize;
+  const agg::rect_i tile(x1, y1,
+                         std::min(x1 + kTileSize, job->width) - 1,
+                         std::min(y1 + kTileSize, job->height) - 1);
+  agg::rendering_buffer rbuf;
+  rbuf.attach(job->buf, job->width, job->height, job->width * 4);
+  pixfmt pixf(rbuf);
+  renderer_base ren_base(pixf);
+  ren_base.clip_box(tile.x1, tile.y1, tile.x2, tile.y2);
+  renderer_scanline ren(ren_base);
+  job->list->RenderIntersecting(tile, job->width, job->height, ren_base, ren);
+}
+
+}  // namespace
+
 int render_to_buffer(
     const DisplayTree& tree,
+    const SpecOverlay* overlay,
     const Matrix& view_transform,
     int width,
     int height,
@@ -101,16 +136,87 @@ int render_to_buffer(
   pixfmt pixf(rbuf);
   renderer_base ren_base(pixf);
   ren_base.clear(Color(0, 0, 0, 0));
+  RenderList list;
+  list.Build(tree, overlay, view_transform);
+  list.Cull(width, height);
+  const int columns = (width + kTileSize - 1) / kTileSize;
+  const int rows = (height + kTileSize - 1) / kTileSize;
+  if (ThreadCount() > 1 && columns * rows > 1) {
+    TileJob job;
+    job.list = &list;
+    job.width = width;
+    job.height = height;
+    job.columns = columns;
+    job.first_row = 0;
+    job.buf = buf;
+    ParallelFor(columns * rows, render_tile, &job);
+    return 0;
+  }
   renderer_scanline ren(ren_base);
-  tree.Render(view_transform, NULL, width, height, ren_base, ren);
+  list.Render(0, list.size(), width, height, ren_base, ren);
   return 0;
 }
 
-void get_output_dimensions(const DisplayTree& tree, int* width_out, int* height_out) {
+// Paints items [begin, end) of list into buf, which already holds
+// whatever should be underneath them.
+void render_list_to_buffer(
+    const RenderList& list,
+    int begin,
+    int end,
+    int width,
+    int height,
+    unsigned char* buf) {
+  agg::rendering_buffer rbuf;
+  rbuf.attach(buf, width, height, width * 4);
+  pixfmt pixf(rbuf);
+  renderer_base ren_base(pixf);
+  renderer_scanline ren(ren_base);
+  list.Render(begin, end, width, height, ren_base, ren);
+}
+
+// As render_list_to_buffer, recording the coverage of each item.
+void record_list_to_buffer(
+    const RenderList& list,
+    int begin,
+    int end,
+    int width,
+    int height,
+    unsigned char* buf,
+    std::vector<ShapeCoverage*>* coverage) {
+  agg::rendering_buffer rbuf;
+  rbuf.attach(buf, width, height, width * 4);
+  pixfmt pixf(rbuf);
+  renderer_base ren_base(pixf);
+  renderer_scanline ren(ren_base);
+  list.Record(begin, end, width, height, ren_base, ren, coverage);
+}
+
+// As render_list_to_buffer, painting from previously recorded coverage.
+void replay_list_to_buffer(
+    const RenderList& list,
+    int begin,
+    int end,
+    const std::vector<ShapeCoverage*>& coverage,
+    int width,
+    int height,
+    unsigned char* buf) {
+  agg::rendering_buffer rbuf;
+  rbuf.attach(buf, width, height, width * 4);
+  pixfmt pixf(rbuf);
+  renderer_base ren_base(pixf);
+  renderer_scanline ren(ren_base);
+  list.Replay(begin, end, coverage, ren_base, ren);
+}
+
+void get_output_dimensions(
+    const DisplayTree& tree,
+    const SpecOverlay* overlay,
+    int* width_out,
+    int* height_out) {
   if (*width_out == 0 || *height_out == 0) {
     int width = 0;
     int height = 0;
-    tree.GetNaturalSizeInPixels(&width, &height);
+    tree.GetNaturalSizeInPixels(overlay, &width, &height);
     if (*width_out > 0) {
       const double r = (double)height / (double)width;
       *height_out = (int)((double)*width_out * r);
@@ -121,16 +227,105 @@ void get_output_dimensions(const DisplayTree& tree, int* width_out, int* height_
   }
 }
 
+// Images of more pixels than this are rendered and encoded in bands.
+static const int kMaxUnbandedPixels = 4096 * 4096;
+
+namespace {
+
+// Renders the band_height rows of list from y1 into band, and appends
+// them to png. Tiles, which bands are made of, are rendered in parallel.
+unsigned render_band(
+    const RenderList& list,
+    int width,
+    int height,
+    int y1,
+    int band_height,
+    unsigned char* band,
+    PngStreamWriter* png) {
+  const int rows = std::min(band_height, height - y1);
+  memset(band, 0, (size_t)rows * width * 4);
+  TileJob job;
+  job.list = &list;
+  job.width = width;
+  job.height = height;
+  job.columns = (width + kTileSize - 1) / kTileSize;
+  job.first_row = y1 / kTileSize;
+  job.buf = band - (size_t)y1 * width * 4;
+  ParallelFor(job.columns * ((rows + kTileSize - 1) / kTileSize),
+              render_tile, &job);
+  return png->WriteRows(band, rows);
+}
+
+// As render_to_png_file, holding only one band of rows at a time. The
+// pixels are the same as a render of the whole image.
+int render_bands_to_png_file(
+    const DisplayTree& tree,
+    const SpecOverlay& overlay,
+    const RunConfig& c,
+    int width,
+    int height) {
+  FILE* file = fopen(c.output_png.c_str(), "wb");
+  if (!file) {
+    printf("Error 79: %s\n", lodepng_error_text(79));
+    return 1;
+  }
+  // Bands are whole rows of tiles.
+  int band_height = c.band_height > 0 ? c.band_height : kTileSize;
+  band_height = (band_height + kTileSize - 1) / kTileSize * kTileSize;
+  Matrix view_transform = create_view_matrix(tree, &overlay, width, height, c.padding);
+  RenderList list;
+  list.Build(tree, &overlay, view_transform);
+  list.Cull(width, height);
+  std::vector<unsigned char> band((size_t)std::min(band_height, height) * width * 4);
+  PngStreamWriter png(file, width, height, c.png_compression);
+  unsigned error = 0;
+  for (int y1 = 0; y1 < height && !error; y1 += band_height) {
+    error = render_band(list, width, height, y1, band_height, &band[0], &png);
+  }
+  if (fclose(file) && !error) {
+    error = 79;
+  }
+  if(error) {
+    printf("Error %u: %s\n", error, lodepng_error_text(error));
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+}  // namespace
+
 int render_to_png_file(const RunConfig& c) {
-  DisplayTree* tree = create_display_tree(c);
+  ScopedDocument document(c.input_swf.c_str());
+  const DisplayTree* tree = document.TreeForClass(c.class_name.c_str());
+  if (!tree) {
+    fprintf(stderr, "No class %s in %s\n", c.class_name.c_str(), c.input_swf.c_str());
+    return 1;
+  }
+  SpecOverlay overlay(*tree);
+  if (c.spec.size()) {
+    tree->ApplySpec(c.spec.c_str(), &overlay);
+  }
   int width = c.width;
   int height = c.height;
   int pad = c.padding;
-  get_output_dimensions(*tree, &width, &height);
+  get_output_dimensions(*tree, &overlay, &width, &height);
+  if (c.output_format == kOutputPng &&
+      (c.band_height > 0 || (double)width * height > kMaxUnbandedPixels)) {
+    return render_bands_to_png_file(*tree, overlay, c, width, height);
+  }
   unsigned char* buf = new unsigned char[width * height * 4];
-  Matrix view_transform = create_view_matrix(*tree, width, height, pad);
-  render_to_buffer(*tree, view_transform, width, height, buf);
-  unsigned error = lodepng_encode32_file(c.output_png.c_str(), buf, width, height);
+  Matrix view_transform = create_view_matrix(*tree, &overlay, width, height, pad);
+  render_to_buffer(*tree, &overlay, view_transform, width, height, buf);
+  unsigned char* image = NULL;
+  size_t size = 0;
+  unsigned error = EncodeImage(buf, width, height, c.output_format,
+                               c.png_compression, &image, &size);
+  delete[] buf;
+  if (!error) {
+    error = lodepng_save_file(image, size, c.output_png.c_str());
+  }
+  free(image);
   if(error) {
     printf("Error %u: %s\n", error, lodepng_error_text(error));
     return 1;
@@ -139,17 +334,172 @@ int render_to_png_file(const RunConfig& c) {
   }
 }
 
-int render_to_png_buffer(const RunConfig& c, Result* result) {
-  DisplayTree* tree = create_display_tree(c);
+int render_tree_to_png_buffer(
+    const DisplayTree& tree,
+    const SpecOverlay& overlay,
+    const RunConfig& c,
+    Result* result) {
   int width = c.width;
   int height = c.height;
   int pad = c.padding;
-  get_output_dimensions(*tree, &width, &height);
+  get_output_dimensions(tree, &overlay, &width, &height);
   unsigned char* buf = new unsigned char[width * height * 4];
-  Matrix view_transform = create_view_matrix(*tree, width, height, pad);
+  Matrix view_transform = create_view_matrix(tree, &overlay, width, height, pad);
+  view_transform.transform(&result->origin_x, &result->origin_y);
+  render_to_buffer(tree, &overlay, view_transform, width, height, buf);
+  unsigned error = EncodeImage(buf, width, height, c.output_format,
+                               c.png_compression, &result->data, &result->size);
+  delete[] buf;
+  if(error) {
+    printf("Error %u: %s\n", error, lodepng_error_text(error));
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+int render_to_png_buffer(const RunConfig& c, Result* result) {
+  ScopedDocument document(c.input_swf.c_str());
+  const DisplayTree* tree = document.TreeForClass(c.class_name.c_str());
+  if (!tree) return 1;
+  SpecOverlay overlay(*tree);
+  if (c.spec.size()) {
+    tree->ApplySpec(c.spec.c_str(), &overlay);
+  }
+  return render_tree_to_png_buffer(*tree, overlay, c, result);
+}
+
+bool ParseRawFormat(const char* name, RawFormat* format) {
+  if (!strcmp(name, "rgba")) {
+    *format = kRawRGBA;
+  } else if (!strcmp(name, "bgra")) {
+    *format = kRawBGRA;
+  } else if (!strcmp(name, "rgba_premultiplied")) {
+    *format = kRawPremultipliedRGBA;
+  } else if (!strcmp(name, "bgra_premultiplied")) {
+    *format = kRawPremultipliedBGRA;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+// Converts count plain RGBA pixels in place. Branch free, so that the
+// compiler vectorizes it.
+void convert_pixels(unsigned char* p, int count, RawFormat format) {
+  const bool bgra = format == kRawBGRA || format == kRawPremultipliedBGRA;
+  const bool premultiply =
+      format == kRawPremultipliedRGBA || format == kRawPremultipliedBGRA;
+  if (premultiply) {
+    for (int i = 0; i < count * 4; i += 4) {
+      const unsigned a = p[i + 3];
+      unsigned r = p[i] * a + 128;
+      unsigned g = p[i + 1] * a + 128;
+      unsigned b = p[i + 2] * a + 128;
+      // x / 255, rounded, for x up to 255 * 255.
+      p[i] = (r + (r >> 8)) >> 8;
+      p[i + 1] = (g + (g >> 8)) >> 8;
+      p[i + 2] = (b + (b >> 8)) >> 8;
+    }
+  }
+  if (bgra) {
+    for (int i = 0; i < count * 4; i += 4) {
+      const unsigned char r = p[i];
+      p[i] = p[i + 2];
+      p[i + 2] = r;
+    }
+  }
+}
+
+}  // namespace
+
+int render_to_raw_buffer(
+    const RunConfig& c,
+    RawFormat format,
+    unsigned char* (*allocate)(size_t size, void* context),
+    void* context,
+    Result* result) {
+  ScopedDocument document(c.input_swf.c_str());
+  const DisplayTree* tree = document.TreeForClass(c.class_name.c_str());
+  if (!tree) return 1;
+  SpecOverlay overlay(*tree);
+  if (c.spec.size()) {
+    tree->ApplySpec(c.spec.c_str(), &overlay);
+  }
+  int width = c.width;
+  int height = c.height;
+  get_output_dimensions(*tree, &overlay, &width, &height);
+  if (width <= 0 || height <= 0) return 1;
+  Matrix view_transform = create_view_matrix(*tree, &overlay, width, height, c.padding);
   view_transform.transform(&result->origin_x, &result->origin_y);
-  render_to_buffer(*tree, view_transform, width, height, buf);
-  unsigned error = lodepng_encode32(&result->data, &result->size, buf, width, height);
+  result->width = width;
+  result->height = height;
+  result->stride = width * 4;
+  result->size = (size_t)height * result->stride;
+  unsigned char* buf = allocate(result->size, context);
+  if (!buf) return 1;
+  render_to_buffer(*tree, &overlay, view_transform, width, height, buf);
+  convert_pixels(buf, width * height, format);
+  return 0;
+}
+
+CompiledSpec* compile_spec(const RunConfig& c) {
+  const Document* document = Document::Open(c.input_swf.c_str());
+  if (!document) return NULL;
+  const DisplayTree* tree = document->TreeForClass(c.class_name.c_str());
+  if (!tree) {
+    Document::Release(document);
+    return NULL;
+  }
+  CompiledSpec* compiled = new CompiledSpec();
+  compiled->document = document;
+  compiled->tree = tree;
+  compiled->program = new SpecProgram(*tree, c.spec.c_str());
+  return compiled;
+}
+
+int render_compiled_to_png_buffer(
+    const CompiledSpec& compiled,
+    const SpecArgs* args,
+    const RunConfig& c,
+    Result* result) {
+  SpecOverlay overlay(*compiled.tree);
+  compiled.program->Apply(&overlay, args);
+  return render_tree_to_png_buffer(*compiled.tree, overlay, c, result);
+}
+
+RenderSession* open_session(const RunConfig& c) {
+  const Document* document = Document::Open(c.input_swf.c_str());
+  if (!document) return NULL;
+  const DisplayTree* tree = document->TreeForClass(c.class_name.c_str());
+  if (!tree) {
+    Document::Release(document);
+    return NULL;
+  }
+  return new RenderSession(document, tree, c);
+}
+
+int render_session_to_png_buffer(
+    RenderSession* session,
+    const std::string& spec,
+    Result* result) {
+  const DisplayTree& tree = session->tree();
+  const RunConfig& c = session->config();
+  SpecOverlay* overlay = new SpecOverlay(tree);
+  if (spec.size()) {
+    tree.ApplySpec(spec.c_str(), overlay);
+  }
+  int width = c.width;
+  int height = c.height;
+  get_output_dimensions(tree, overlay, &width, &height);
+  Matrix view_transform = create_view_matrix(tree, overlay, width, height, c.padding);
+  session->Update(overlay, width, height, view_transform);
+  view_transform.transform(&result->origin_x, &result->origin_y);
+  unsigned error = EncodeImage(session->pixels(), width, height,
+                               c.output_format, c.png_compression,
+                               &result->data, &result->size);
   if(error) {
     printf("Error %u: %s\n", error, lodepng_error_text(error));
     return 1;
@@ -158,28 +508,400 @@ int render_to_png_buffer(const RunConfig& c, Result* result) {
   }
 }
 
+namespace {
+
+// Variants that hide and move the same nodes share their output size,
+// their view transform and every shape painted before the first node any
+// of them overrides. Those shapes are rendered once per group.
+//
+// Past that point the variants of a group differ only in color, so
+// their shapes cover the same pixels. When a group has several variants
+// the first one is rendered while recording that coverage, and the rest
+// replay it in their own colors instead of rasterizing again.
+struct VariantGroup {
+  const SpecOverlay* geometry;
+  int first_overridden;
+  int first_variant;
+  int num_variants;
+  int width;
+  int height;
+  Matrix view_transform;
+  std::vector<unsigned char> base;
+  // Only filled in when coverage was recorded.
+  std::vector<ShapeCoverage*> coverage;
+  std::vector<unsigned char> first_pixels;
+};
+
+struct VariantBatch {
+  const DisplayTree* tree;
+  const RunConfig* config;
+  std::vector<SpecOverlay*> overlays;
+  std::vector<int> group_of;
+  std::vector<VariantGroup> groups;
+  Result* results;
+};
+
+void render_variant_group_base(int g, void* context) {
+  VariantBatch* batch = static_cast<VariantBatch*>(context);
+  VariantGroup& group = batch->groups[g];
+  const RunConfig& c = *batch->config;
+  group.width = c.width;
+  group.height = c.height;
+  get_output_dimensions(*batch->tree, group.geometry, &group.width, &group.height);
+  group.view_transform = create_view_matrix(
+      *batch->tree, group.geometry, group.width, group.height, c.padding);
+  group.base.assign(group.width * group.height * 4, 0);
+  RenderList list;
+  list.Build(*batch->tree, group.geometry, group.view_transform);
+  const int shared = group.first_overridden < 0 ?
+      list.size() : list.FirstItemAtOrAfter(group.first_overridden);
+  render_list_to_buffer(list, 0, shared, group.width, group.height, &group.base[0]);
+  if (group.num_variants > 1 && shared < list.size()) {
+    group.first_pixels = group.base;
+    record_list_to_buffer(list, shared, list.size(), group.width, group.height,
+                          &group.first_pixels[0], &group.coverage);
+  }
+}
+
+void render_variant(int v, void* context) {
+  VariantBatch* batch = static_cast<VariantBatch*>(context);
+  const VariantGroup& group = batch->groups[batch->group_of[v]];
+  Result* result = &batch->results[v];
+  const bool recorded = !group.first_pixels.empty();
+  const bool done = recorded && v == group.first_variant;
+  std::vector<unsigned char> buf(done ? group.first_pixels : group.base);
+  if (group.first_overridden >= 0 && !done) {
+    RenderList list;
+    list.Build(*batch->tree, batch->overlays[v], group.view_transform);
+    const int shared = list.FirstItemAtOrAfter(group.first_overridden);
+    if (recorded) {
+      replay_list_to_buffer(list, shared, list.size(), group.coverage,
+                            group.width, group.height, &buf[0]);
+    } else {
+      render_list_to_buffer(list, shared, list.size(),
+                            group.width, group.height, &buf[0]);
+    }
+  }
+  group.view_transform.transform(&result->origin_x, &result->origin_y);
+  unsigned error = EncodeImage(&buf[0], group.width, group.height,
+                               batch->config->output_format,
+                               batch->config->png_compression,
+                               &result->data, &result->size);
+  if(error) {
+    printf("Error %u: %s\n", error, lodepng_error_text(error));
+  }
+}
+
+}  // namespace
+
+int render_variants_to_png_buffers(
+    const RunConfig& c,
+    const std::vector<std::string>& specs,
+    Result* results) {
+  ScopedDocument document(c.input_swf.c_str());
+  const DisplayTree* tree = document.TreeForClass(c.class_name.c_str());
+  if (!tree) return 1;
+  VariantBatch batch;
+  batch.tree = tree;
+  batch.config = &c;
+  batch.results = results;
+  for (int v = 0; v < specs.size(); v++) {
+    SpecOverlay* overlay = new SpecOverlay(*tree);
+    tree->ApplySpec(specs[v].c_str(), overlay);
+    batch.overlays.push_back(overlay);
+    int g = 0;
+    while (g < batch.groups.size() &&
+           !batch.groups[g].geometry->SameGeometry(*overlay)) {
+      ++g;
+    }
+    const int first = overlay->FirstOverriddenNode();
+    if (g == batch.groups.size()) {
+      VariantGroup group;
+      group.geometry = overlay;
+      group.first_overridden = first;
+      group.first_variant = v;
+      group.num_variants = 1;
+      batch.groups.push_back(group);
+    } else {
+      batch.groups[g].num_variants++;
+      if (first >= 0) {
+        int& shared = batch.groups[g].first_overridden;
+        shared = shared < 0 ? first : std::min(shared, first);
+      }
+    }
+    batch.group_of.push_back(g);
+  }
+  ParallelFor(batch.groups.size(), render_variant_group_base, &batch);
+  ParallelFor(specs.size(), render_variant, &batch);
+  for (int v = 0; v < batch.overlays.size(); v++) {
+    delete batch.overlays[v];
+  }
+  for (int g = 0; g < batch.groups.size(); g++) {
+    std::vector<ShapeCoverage*>& coverage = batch.groups[g].coverage;
+    for (int i = 0; i < coverage.size(); i++) {
+      delete coverage[i];
+    }
+  }
+  return 0;
+}
+
 int get_metadata(const RunConfig& c, Result* result) {
-  DisplayTree* tree = create_display_tree(c);
+  ScopedDocument document(c.input_swf.c_str());
+  const DisplayTree* tree = document.TreeForClass(c.class_name.c_str());
+  if (!tree) return 1;
+  SpecOverlay overlay(*tree);
+  if (c.spec.size()) {
+    tree->ApplySpec(c.spec.c_str(), &overlay);
+  }
 
   int width = c.width;
   int height = c.height;
   int pad = c.padding;
-  get_output_dimensions(*tree, &width, &height);
+  get_output_dimensions(*tree, &overlay, &width, &height);
 
-  tree->GetNaturalSizeInPixels(&result->natural_width, &result->natural_height);
+  tree->GetNaturalSizeInPixels(&overlay, &result->natural_width, &result->natural_height);
 
-  Matrix view_transform = create_view_matrix(*tree, width, height, pad);
+  Matrix view_transform = create_view_matrix(*tree, &overlay, width, height, pad);
   view_transform.transform(&result->origin_x, &result->origin_y);
 
   return 0;
 }
 
+// Milliseconds per render_to_buffer call, averaged over iterations.
+double time_renders(const DisplayTree& tree,
+                    const SpecOverlay* overlay,
+                    const Matrix& view_transform,
+                    int width, int height,
+                    int iterations,
+                    unsigned char* buf) {
+  render_to_buffer(tree, overlay, view_transform, width, height, buf);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < iterations; i++) {
+    render_to_buffer(tree, overlay, view_transform, width, height, buf);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e3 +
+          (end.tv_nsec - start.tv_nsec) / 1e6) / iterations;
+}
+
+// Renders c repeatedly with 1 up to ThreadCount() threads and prints the
+// time per render for each, to show how tiled rendering scales.
+int benchmark_scaling(const RunConfig& c, int iterations) {
+  ScopedDocument document(c.input_swf.c_str());
+  const DisplayTree* tree = document.TreeForClass(c.class_name.c_str());
+  if (!tree) {
+    fprintf(stderr, "No class %s in %s\n", c.class_name.c_str(), c.input_swf.c_str());
+    return 1;
+  }
+  SpecOverlay overlay(*tree);
+  int width = c.width;
+  int height = c.height;
+  get_output_dimensions(*tree, &overlay, &width, &height);
+  Matrix view_transform = create_view_matrix(*tree, &overlay, width, height, c.padding);
+  std::vector<unsigned char> buf(width * height * 4);
+  const int max_threads = ThreadCount();
+  double single = 0;
+  RenderList list;
+  list.Build(*tree, &overlay, view_transform);
+  const int shapes = list.size();
+  const int culled = list.Cull(width, height);
+  printf("%dx%d, %d iterations, %d of %d shapes culled\n",
+         width, height, iterations, culled, shapes);
+  for (int threads = 1; threads <= max_threads; threads++) {
+    SetThreadCount(threads);
+    const double ms = time_renders(*tree, &overlay, view_transform,
+                                   width, height, iterations, &buf[0]);
+    if (threads == 1) single = ms;
+    printf("threads %2d: %8.2f ms  x%.2f\n", threads, ms, single / ms);
+  }
+  SetThreadCount(max_threads);
+  return 0;
+}
+
+namespace {
+
+bool more_records(const Shape* a, const Shape* b) {
+  return a->records.size() > b->records.size();
+}
+
+}  // namespace
+
+// Rasterizes each of the largest shapes of c on its own, scaled to fill
+// a square frame of 2048 and then 4096 pixels, and prints the time per
+// shape. Big frames are where cell sorting and allocation cost the most.
+int benchmark_shapes(const RunConfig& c, int iterations) {
+  ScopedDocument document(c.input_swf.c_str());
+  const DisplayTree* tree = document.TreeForClass(c.class_name.c_str());
+  if (!tree) {
+    fprintf(stderr, "No class %s in %s\n", c.class_name.c_str(), c.input_swf.c_str());
+    return 1;
+  }
+  RenderList list;
+  list.Build(*tree, NULL, Matrix());
+  std::vector<const Shape*> shapes;
+  for (int i = 0; i < list.size(); i++) {
+    const Shape* shape = list.items[i].node->shape;
+    if (std::find(shapes.begin(), shapes.end(), shape) == shapes.end()) {
+      shapes.push_back(shape);
+    }
+  }
+  std::sort(shapes.begin(), shapes.end(), more_records);
+  shapes.resize(std::min<size_t>(shapes.size(), 3));
+  const int sizes[] = {2048, 4096};
+  for (int s = 0; s < 2; s++) {
+    const int size = sizes[s];
+    std::vector<unsigned char> buf(size * size * 4);
+    agg::rendering_buffer rbuf;
+    rbuf.attach(&buf[0], size, size, size * 4);
+    pixfmt pixf(rbuf);
+    renderer_base ren_base(pixf);
+    renderer_scanline ren(ren_base);
+    for (int i = 0; i < shapes.size(); i++) {
+      const Shape& shape = *shapes[i];
+      double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+      DisplayTree::GetShapeBounds(shape, Matrix(), &x1, &x2, &y1, &y2);
+      agg::trans_viewport vp;
+      vp.preserve_aspect_ratio(0.5, 0.5, agg::aspect_ratio_meet);
+      vp.world_viewport(x1, y1, x2, y2);
+      vp.device_viewport(0, 0, size, size);
+      const Matrix transform = vp.to_affine();
+      DisplayTree::RenderShape(shape, transform, NULL, size, size, ren_base, ren);
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int k = 0; k < iterations; k++) {
+        DisplayTree::RenderShape(shape, transform, NULL, size, size, ren_base, ren);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      const double ms = ((end.tv_sec - start.tv_sec) * 1e3 +
+                         (end.tv_nsec - start.tv_nsec) / 1e6) / iterations;
+      printf("%dpx shape %d (%d records): %8.2f ms\n",
+             size, shape.character_id, (int)shape.records.size(), ms);
+    }
+  }
+  return 0;
+}
+
+// Renders c once and encodes it repeatedly with each PngCompression and
+// each other OutputFormat, printing the time per encode and the size of
+// the output.
+int benchmark_encoding(const RunConfig& c, int iterations) {
+  ScopedDocument document(c.input_swf.c_str());
+  const DisplayTree* tree = document.TreeForClass(c.class_name.c_str());
+  if (!tree) {
+    fprintf(stderr, "No class %s in %s\n", c.class_name.c_str(), c.input_swf.c_str());
+    return 1;
+  }
+  SpecOverlay overlay(*tree);
+  int width = c.width;
+  int height = c.height;
+  get_output_dimensions(*tree, &overlay, &width, &height);
+  Matrix view_transform = create_view_matrix(*tree, &overlay, width, height, c.padding);
+  std::vector<unsigned char> buf(width * height * 4);
+  const double render_ms = time_renders(*tree, &overlay, view_transform,
+                                        width, height, 1, &buf[0]);
+  printf("%dx%d, %d iterations, render %.2f ms\n",
+         width, height, iterations, render_ms);
+  const char* names[] = {"fast", "default", "small", "qoi", "pam"};
+  for (int i = 0; i < 5; i++) {
+    OutputFormat format = kOutputPng;
+    PngCompression compression = kPngDefault;
+    if (!ParsePngCompression(names[i], &compression)) {
+      ParseOutputFormat(names[i], &format);
+    }
+    size_t size = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int k = 0; k < iterations; k++) {
+      unsigned char* image = NULL;
+      EncodeImage(&buf[0], width, height, format, compression, &image, &size);
+      free(image);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double ms = ((end.tv_sec - start.tv_sec) * 1e3 +
+                       (end.tv_nsec - start.tv_nsec) / 1e6) / iterations;
+    printf("%-8s %8.2f ms %9d bytes\n", names[i], ms, (int)size);
+  }
+  return 0;
+}
+
+namespace {
+
+unsigned char* allocate_pixels(size_t size, void* context) {
+  unsigned char** pixels = static_cast<unsigned char**>(context);
+  *pixels = static_cast<unsigned char*>(malloc(size));
+  return *pixels;
+}
+
+}  // namespace
+
+// Writes the raw pixels of c to c.output_png, with no header.
+int render_to_raw_file(const RunConfig& c, RawFormat format) {
+  unsigned char* pixels = NULL;
+  Result result;
+  int error = render_to_raw_buffer(c, format, allocate_pixels, &pixels, &result);
+  if (!error) {
+    FILE* file = fopen(c.output_png.c_str(), "wb");
+    error = !file || fwrite(pixels, 1, result.size, file) != result.size;
+    if (file) fclose(file);
+    if (!error) {
+      printf("%dx%d, stride %d\n", result.width, result.height, result.stride);
+    }
+  }
+  free(pixels);
+  if (error) {
+    fprintf(stderr, "Can't render %s to %s\n", c.class_name.c_str(), c.output_png.c_str());
+  }
+  return error;
+}
+
 int main(int argc, char* argv[]) {
   RunConfig config;
   int c;
   int opterr = 0;
-  while ((c = getopt (argc, argv, "w:h:o:c:p:")) != -1) {
+  int benchmark_iterations = 0;
+  int shape_iterations = 0;
+  int encode_iterations = 0;
+  bool raw = false;
+  bool format_given = false;
+  RawFormat raw_format = kRawRGBA;
+  while ((c = getopt (argc, argv, "w:h:o:c:p:j:b:s:e:z:r:B:f:")) != -1) {
     switch (c) {
+      case 'f':
+        format_given = true;
+        if (!ParseOutputFormat(optarg, &config.output_format)) {
+          fprintf(stderr, "Unknown output format %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'B':
+        config.band_height = strtol(optarg, 0, 10);
+        break;
+      case 'r':
+        raw = true;
+        if (!ParseRawFormat(optarg, &raw_format)) {
+          fprintf(stderr, "Unknown raw format %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'e':
+        encode_iterations = strtol(optarg, 0, 10);
+        break;
+      case 'z':
+        if (!ParsePngCompression(optarg, &config.png_compression)) {
+          fprintf(stderr, "Unknown compression %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 's':
+        shape_iterations = strtol(optarg, 0, 10);
+        break;
+      case 'j':
+        SetThreadCount(strtol(optarg, 0, 10));
+        break;
+      case 'b':
+        benchmark_iterations = strtol(optarg, 0, 10);
+        break;
       case 'w':
         config.width = strtol(optarg, 0, 10);
         break;
@@ -209,7 +931,23 @@ int main(int argc, char* argv[]) {
     return 1;
   }
   config.input_swf = argv[optind];
+  // Without -f, the format is the one -o's extension names, if any.
+  if (!format_given) {
+    OutputFormatForPath(config.output_png, &config.output_format);
+  }
 
+  if (encode_iterations > 0) {
+    return benchmark_encoding(config, encode_iterations);
+  }
+  if (shape_iterations > 0) {
+    return benchmark_shapes(config, shape_iterations);
+  }
+  if (benchmark_iterations > 0) {
+    return benchmark_scaling(config, benchmark_iterations);
+  }
+  if (raw) {
+    return render_to_raw_file(config, raw_format);
+  }
   return render_to_png_file(config);
 }
 
@@ -22,12 +22,73 @@
 #define SRC_FLASH_RASTERIZER
 
 #include <stdlib.h>
+#include <string>
+#include <vector>
 
 struct RunConfig;
 struct Result;
+struct CompiledSpec;
+class RenderSession;
+class SpecArgs;
 
 int render_to_png_file(const RunConfig& c);
 int render_to_png_buffer(const RunConfig& c, Result* result);
 int get_metadata(const RunConfig& c, Result* result);
 
+// Layouts of the pixels render_to_raw_buffer produces. Renders are plain
+// RGBA.
+enum RawFormat {
+  kRawRGBA,
+  kRawBGRA,
+  kRawPremultipliedRGBA,
+  kRawPremultipliedBGRA
+};
+
+// Parses "rgba", "bgra", "rgba_premultiplied" or "bgra_premultiplied".
+// Returns false for anything else.
+bool ParseRawFormat(const char* name, RawFormat* format);
+
+// Renders c in format, without encoding, straight into memory returned
+// by allocate(size, context). Sets result's size, width, height, stride
+// and origin, but not its data. allocate is only called once the size
+// is known, and isn't called if there is nothing to render.
+int render_to_raw_buffer(
+    const RunConfig& c,
+    RawFormat format,
+    unsigned char* (*allocate)(size_t size, void* context),
+    void* context,
+    Result* result);
+
+// Renders one image per spec, in c.output_format, into results, which must have room for
+// specs.size() entries. Variants share the parsed document and tree, and
+// whatever they have in common is rasterized once; the variants
+// themselves are rendered in parallel.
+int render_variants_to_png_buffers(
+    const RunConfig& c,
+    const std::vector<std::string>& specs,
+    Result* results);
+
+// Parses c.input_swf and compiles c.spec against c.class_name. Returns
+// NULL if the file can't be parsed or has no such class.
+CompiledSpec* compile_spec(const RunConfig& c);
+
+// Renders a compiled spec at the size given by c. args may be NULL.
+int render_compiled_to_png_buffer(
+    const CompiledSpec& compiled,
+    const SpecArgs* args,
+    const RunConfig& c,
+    Result* result);
+
+// Starts an incremental rendering session for c.class_name at the size
+// given by c. Returns NULL if the file can't be parsed or has no such
+// class.
+RenderSession* open_session(const RunConfig& c);
+
+// Renders spec within session. Only the part of the previous frame that
+// the change from the previous spec affects is painted again.
+int render_session_to_png_buffer(
+    RenderSession* session,
+    const std::string& spec,
+    Result* result);
+
 #endif
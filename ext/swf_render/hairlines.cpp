@@ -0,0 +1,27 @@
+#include "hairlines.h"
+
+#include "agg_rasterizer_outline_aa.h"
+#include "agg_renderer_outline_aa.h"
+#include "agg_gamma_functions.h"
+
+void Hairlines::Draw(
+    const ColorMatrix* color_matrix,
+    int clip_width, int clip_height,
+    renderer_base& ren_base) const {
+  if (m_ids.empty()) return;
+  typedef agg::renderer_outline_aa<renderer_base> renderer_outline;
+  agg::line_profile_aa profile(1.0, agg::gamma_none());
+  renderer_outline ren(ren_base, profile);
+  ren.clip_box(0, 0, clip_width, clip_height);
+  agg::rasterizer_outline_aa<renderer_outline> ras(ren);
+  agg::path_storage_reader<agg::path_storage> paths(m_paths);
+  for (unsigned i = 0; i < m_ids.size(); i++) {
+    Color c = make_rgba(m_styles[i]->rgba);
+    if (color_matrix) {
+      color_matrix->transform(&c);
+    }
+    ren.color(c);
+    ras.round_cap(m_styles[i]->start_cap_style == LineStyle::kCapRound);
+    ras.add_path(paths, m_ids[i]);
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef _HAIRLINES_H
+#define _HAIRLINES_H
+
+#include <vector>
+
+#include "agg_path_storage.h"
+
+#include "display_tree.h"
+
+// Width 1 strokes, which Flash draws one pixel wide at any scale. Rather
+// than being stroked into polygons for the scanline rasterizer, their
+// device space outlines are collected here and drawn directly as
+// anti-aliased lines by agg::renderer_outline_aa.
+class Hairlines {
+public:
+  // Appends the outline vs produces for path_id, to be drawn with style.
+  template<class VertexSource>
+  void Add(VertexSource& vs, unsigned path_id, const LineStyle* style) {
+    m_ids.push_back(m_paths.start_new_path());
+    m_paths.concat_path(vs, path_id);
+    m_styles.push_back(style);
+  }
+
+  bool empty() const { return m_ids.empty(); }
+
+  // Draws the lines in the order they were added. Lines are clipped to
+  // the clip_width by clip_height frame, not to the clip box of ren_base,
+  // so a tile paints exactly the pixels a full render would. Safe to call
+  // from several threads at once.
+  void Draw(const ColorMatrix* color_matrix,
+            int clip_width, int clip_height,
+            renderer_base& ren_base) const;
+
+private:
+  agg::path_storage m_paths;
+  std::vector<unsigned> m_ids;
+  std::vector<const LineStyle*> m_styles;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "image_encoder.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+// lodepng's error for a failed allocation.
+const unsigned kOutOfMemory = 83;
+
+void AppendBigEndian(unsigned value, unsigned char* out) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+// See https://qoiformat.org/qoi-specification.pdf. Each pixel is a run
+// of the one before, a hit in a table of recently seen pixels, a small
+// difference from the one before, or written out in full.
+unsigned EncodeQoi(const unsigned char* rgba, int width, int height,
+                   unsigned char** out, size_t* size) {
+  const size_t pixels = (size_t)width * height;
+  // Header, at worst five bytes a pixel, and the end marker.
+  unsigned char* p = static_cast<unsigned char*>(malloc(14 + pixels * 5 + 8));
+  if (!p) return kOutOfMemory;
+  *out = p;
+  memcpy(p, "qoif", 4);
+  AppendBigEndian(width, p + 4);
+  AppendBigEndian(height, p + 8);
+  p[12] = 4;
+  // sRGB with linear alpha.
+  p[13] = 0;
+  p += 14;
+  unsigned char seen[64 * 4];
+  memset(seen, 0, sizeof(seen));
+  unsigned char prev[4] = {0, 0, 0, 255};
+  int run = 0;
+  for (size_t i = 0; i < pixels; i++) {
+    const unsigned char* px = rgba + i * 4;
+    if (!memcmp(px, prev, 4)) {
+      if (++run == 62 || i == pixels - 1) {
+        *p++ = 0xc0 | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      *p++ = 0xc0 | (run - 1);
+      run = 0;
+    }
+    const int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+    if (!memcmp(px, seen + hash * 4, 4)) {
+      *p++ = hash;
+    } else {
+      memcpy(seen + hash * 4, px, 4);
+      if (px[3] == prev[3]) {
+        const signed char dr = px[0] - prev[0];
+        const signed char dg = px[1] - prev[1];
+        const signed char db = px[2] - prev[2];
+        const signed char dr_dg = dr - dg;
+        const signed char db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+            db >= -2 && db <= 1) {
+          *p++ = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+        } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                   db_dg >= -8 && db_dg <= 7) {
+          *p++ = 0x80 | (dg + 32);
+          *p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+        } else {
+          *p++ = 0xfe;
+          memcpy(p, px, 3);
+          p += 3;
+        }
+      } else {
+        *p++ = 0xff;
+        memcpy(p, px, 4);
+        p += 4;
+      }
+    }
+    memcpy(prev, px, 4);
+  }
+  memcpy(p, "\0\0\0\0\0\0\0\1", 8);
+  p += 8;
+  *size = p - *out;
+  return 0;
+}
+
+// A Netpbm header followed by the pixels as they are, or without alpha.
+unsigned EncodeNetpbm(const unsigned char* rgba, int width, int height,
+                      bool alpha, unsigned char** out, size_t* size) {
+  char header[128];
+  const int header_size = alpha ?
+      snprintf(header, sizeof(header),
+               "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\n"
+               "TUPLTYPE RGB_ALPHA\nENDHDR\n", width, height) :
+      snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+  const size_t pixels = (size_t)width * height;
+  *size = header_size + pixels * (alpha ? 4 : 3);
+  unsigned char* p = static_cast<unsigned char*>(malloc(*size));
+  if (!p) return kOutOfMemory;
+  *out = p;
+  memcpy(p, header, header_size);
+  p += header_size;
+  if (alpha) {
+    memcpy(p, rgba, pixels * 4);
+  } else {
+    for (size_t i = 0; i < pixels; i++) {
+      p[i * 3] = rgba[i * 4];
+      p[i * 3 + 1] = rgba[i * 4 + 1];
+      p[i * 3 + 2] = rgba[i * 4 + 2];
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+bool ParseOutputFormat(const char* name, OutputFormat* format) {
+  if (!strcmp(name, "png")) {
+    *format = kOutputPng;
+  } else if (!strcmp(name, "qoi")) {
+    *format = kOutputQoi;
+  } else if (!strcmp(name, "pam")) {
+    *format = kOutputPam;
+  } else if (!strcmp(name, "ppm")) {
+    *format = kOutputPpm;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool OutputFormatForPath(const std::string& path, OutputFormat* format) {
+  const size_t dot = path.rfind('.');
+  if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+    return false;
+  }
+  std::string extension = path.substr(dot + 1);
+  for (size_t i = 0; i < extension.size(); i++) {
+    extension[i] = tolower(extension[i]);
+  }
+  return ParseOutputFormat(extension.c_str(), format);
+}
+
+unsigned EncodeImage(const unsigned char* rgba, int width, int height,
+                     OutputFormat format, PngCompression compression,
+                     unsigned char** out, size_t* size) {
+  *out = NULL;
+  *size = 0;
+  switch (format) {
+    case kOutputQoi:
+      return EncodeQoi(rgba, width, height, out, size);
+    case kOutputPam:
+      return EncodeNetpbm(rgba, width, height, true, out, size);
+    case kOutputPpm:
+      return EncodeNetpbm(rgba, width, height, false, out, size);
+    default:
+      return EncodePng(rgba, width, height, compression, out, size);
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef _IMAGEENCODER_H
+#define _IMAGEENCODER_H
+
+#include <stddef.h>
+#include <string>
+
+#include "png_encoder.h"
+
+// Formats a render can be encoded in. Only PNG is compressed with
+// deflate; the others cost little more than a copy of the pixels, for
+// pipelines that compress images themselves further down the line.
+enum OutputFormat {
+  kOutputPng,
+  // The Quite OK Image format: lossless, and encoded in one pass with
+  // no entropy coding.
+  kOutputQoi,
+  // Uncompressed Netpbm PAM, 8 bit RGB_ALPHA.
+  kOutputPam,
+  // Uncompressed binary Netpbm PPM. Alpha is dropped.
+  kOutputPpm
+};
+
+// Parses "png", "qoi", "pam" or "ppm". Returns false for anything else.
+bool ParseOutputFormat(const char* name, OutputFormat* format);
+
+// Picks the format named by the extension of path. Returns false if
+// there is none, or it isn't one of the above.
+bool OutputFormatForPath(const std::string& path, OutputFormat* format);
+
+// Encodes the width x height plain RGBA image in rgba in format, into
+// *out, which the caller frees. compression only applies to PNGs.
+// Returns a lodepng error code.
+unsigned EncodeImage(const unsigned char* rgba, int width, int height,
+                     OutputFormat format, PngCompression compression,
+                     unsigned char** out, size_t* size);
+
+#endif
@@ -0,0 +1,428 @@
+#include "layers.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace {
+
+// Released buffers beyond this many are freed.
+const unsigned kMaxPooledLayers = 8;
+
+struct PooledLayer {
+  unsigned char* buf;
+  size_t size;
+};
+
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<PooledLayer> pool;
+
+// Rows and columns handed to one task.
+const int kRowsPerBand = 32;
+const int kColumnsPerBand = 64;
+
+// Dividing by the width of the box is a multiply by a fixed point
+// reciprocal, which keeps the column loop vectorizable.
+const int kReciprocalShift = 24;
+const int kMaxRadius = 255;
+
+struct BlurJob {
+  const unsigned char* src;
+  unsigned char* dst;
+  int stride;
+  agg::rect_i box;
+  int radius;
+  unsigned reciprocal;
+};
+
+unsigned Reciprocal(int radius) {
+  const unsigned d = 2 * radius + 1;
+  return ((1u << kReciprocalShift) + d / 2) / d;
+}
+
+inline unsigned char Average(unsigned sum, unsigned reciprocal) {
+  return (sum * reciprocal + (1u << (kReciprocalShift - 1))) >> kReciprocalShift;
+}
+
+// a * b / 255, rounded.
+inline unsigned Multiply(unsigned a, unsigned b) {
+  const unsigned t = a * b + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+// Horizontal box blur of the rows in band.
+template<int kChannels>
+void BlurRows(int band, void* context) {
+  const BlurJob& job = *static_cast<const BlurJob*>(context);
+  const int x1 = job.box.x1;
+  const int x2 = job.box.x2;
+  const int r = job.radius;
+  const int y_end = std::min(job.box.y1 + (band + 1) * kRowsPerBand - 1, job.box.y2);
+  for (int y = job.box.y1 + band * kRowsPerBand; y <= y_end; y++) {
+    const unsigned char* src = job.src + y * job.stride;
+    unsigned char* dst = job.dst + y * job.stride;
+    unsigned sum[kChannels] = { 0 };
+    for (int x = x1; x <= std::min(x1 + r, x2); x++) {
+      for (int c = 0; c < kChannels; c++) sum[c] += src[x * kChannels + c];
+    }
+    for (int x = x1; x <= x2; x++) {
+      for (int c = 0; c < kChannels; c++) {
+        dst[x * kChannels + c] = Average(sum[c], job.reciprocal);
+      }
+      const int in = x + r + 1;
+      const int out = x - r;
+      if (in <= x2) {
+        for (int c = 0; c < kChannels; c++) sum[c] += src[in * kChannels + c];
+      }
+      if (out >= x1) {
+        for (int c = 0; c < kChannels; c++) sum[c] -= src[out * kChannels + c];
+      }
+    }
+  }
+}
+
+// Vertical box blur of the columns in band. Whole rows of the band are
+// added and subtracted at a time.
+template<int kChannels>
+void BlurColumns(int band, void* context) {
+  const BlurJob& job = *static_cast<const BlurJob*>(context);
+  const int y1 = job.box.y1;
+  const int y2 = job.box.y2;
+  const int r = job.radius;
+  const int x = job.box.x1 + band * kColumnsPerBand;
+  const int n = (std::min(x + kColumnsPerBand - 1, job.box.x2) - x + 1) * kChannels;
+  const unsigned char* src = job.src + x * kChannels;
+  unsigned char* dst = job.dst + x * kChannels;
+  std::vector<unsigned> sum(n, 0);
+  for (int y = y1; y <= std::min(y1 + r, y2); y++) {
+    const unsigned char* row = src + y * job.stride;
+    for (int i = 0; i < n; i++) sum[i] += row[i];
+  }
+  for (int y = y1; y <= y2; y++) {
+    unsigned char* out_row = dst + y * job.stride;
+    for (int i = 0; i < n; i++) out_row[i] = Average(sum[i], job.reciprocal);
+    if (y + r + 1 <= y2) {
+      const unsigned char* row = src + (y + r + 1) * job.stride;
+      for (int i = 0; i < n; i++) sum[i] += row[i];
+    }
+    if (y - r >= y1) {
+      const unsigned char* row = src + (y - r) * job.stride;
+      for (int i = 0; i < n; i++) sum[i] -= row[i];
+    }
+  }
+}
+
+// Box blurs box of buf, which has kChannels bytes per pixel.
+template<int kChannels>
+void BoxBlur(unsigned char* buf, int width, int height,
+             const agg::rect_i& box,
+             int radius_x, int radius_y, int passes) {
+  radius_x = std::min(radius_x, kMaxRadius);
+  radius_y = std::min(radius_y, kMaxRadius);
+  if (passes <= 0 || (radius_x <= 0 && radius_y <= 0)) return;
+  const int stride = width * kChannels;
+  unsigned char* scratch = LayerPool::Acquire(width, height, kChannels);
+  BlurJob job;
+  job.stride = stride;
+  job.box = box;
+  unsigned char* src = buf;
+  unsigned char* dst = scratch;
+  for (int pass = 0; pass < passes; pass++) {
+    if (radius_x > 0) {
+      job.src = src;
+      job.dst = dst;
+      job.radius = radius_x;
+      job.reciprocal = Reciprocal(radius_x);
+      ParallelFor((box.y2 - box.y1) / kRowsPerBand + 1,
+                  BlurRows<kChannels>, &job);
+      std::swap(src, dst);
+    }
+    if (radius_y > 0) {
+      job.src = src;
+      job.dst = dst;
+      job.radius = radius_y;
+      job.reciprocal = Reciprocal(radius_y);
+      ParallelFor((box.x2 - box.x1) / kColumnsPerBand + 1,
+                  BlurColumns<kChannels>, &job);
+      std::swap(src, dst);
+    }
+  }
+  if (src != buf) {
+    for (int y = box.y1; y <= box.y2; y++) {
+      memcpy(buf + y * stride + box.x1 * kChannels,
+             src + y * stride + box.x1 * kChannels,
+             (box.x2 - box.x1 + 1) * kChannels);
+    }
+  }
+  LayerPool::Release(scratch, width, height, kChannels);
+}
+
+struct ShadowJob {
+  unsigned char* buf;
+  const unsigned char* mask;
+  int width;
+  agg::rect_i box;
+  const LayerFilter* filter;
+};
+
+// Draws the shadow for the rows in band over the premultiplied layer.
+void DrawShadowRows(int band, void* context) {
+  const ShadowJob& job = *static_cast<const ShadowJob*>(context);
+  const LayerFilter& f = *job.filter;
+  const agg::rect_i& box = job.box;
+  const unsigned cr = f.color.r;
+  const unsigned cg = f.color.g;
+  const unsigned cb = f.color.b;
+  const unsigned ca = f.color.a;
+  const int y_end = std::min(box.y1 + (band + 1) * kRowsPerBand - 1, box.y2);
+  for (int y = box.y1 + band * kRowsPerBand; y <= y_end; y++) {
+    unsigned char* p = job.buf + (y * job.width + box.x1) * 4;
+    const int my = y - f.dy;
+    const bool row_in = my >= box.y1 && my <= box.y2;
+    const unsigned char* mask_row = job.mask + my * job.width;
+    for (int x = box.x1; x <= box.x2; x++, p += 4) {
+      const int mx = x - f.dx;
+      unsigned m = row_in && mx >= box.x1 && mx <= box.x2 ? mask_row[mx] : 0;
+      if (f.inner) m = 255 - m;
+      m = std::min(255u, (m * f.strength + 128) >> 8);
+      const unsigned sa = p[3];
+      if (f.inner) {
+        // Color drawn inside the layer, where its blurred alpha fades.
+        const unsigned a = Multiply(Multiply(m, ca), sa);
+        if (f.knockout || !f.composite_source) {
+          p[0] = Multiply(cr, a);
+          p[1] = Multiply(cg, a);
+          p[2] = Multiply(cb, a);
+          p[3] = a;
+        } else {
+          p[0] = Multiply(cr, a) + Multiply(p[0], 255 - a);
+          p[1] = Multiply(cg, a) + Multiply(p[1], 255 - a);
+          p[2] = Multiply(cb, a) + Multiply(p[2], 255 - a);
+        }
+      } else {
+        // Color drawn under the layer, or cut out by it.
+        unsigned a = Multiply(m, ca);
+        if (f.knockout) {
+          a = Multiply(a, 255 - sa);
+          p[0] = Multiply(cr, a);
+          p[1] = Multiply(cg, a);
+          p[2] = Multiply(cb, a);
+          p[3] = a;
+        } else if (f.composite_source) {
+          a = Multiply(a, 255 - sa);
+          p[0] += Multiply(cr, a);
+          p[1] += Multiply(cg, a);
+          p[2] += Multiply(cb, a);
+          p[3] += a;
+        } else {
+          p[0] = Multiply(cr, a);
+          p[1] = Multiply(cg, a);
+          p[2] = Multiply(cb, a);
+          p[3] = a;
+        }
+      }
+    }
+  }
+}
+
+void DrawShadow(unsigned char* buf, int width, int height,
+                const agg::rect_i& box,
+                const LayerFilter& filter) {
+  unsigned char* mask = LayerPool::Acquire(width, height, 1);
+  for (int y = box.y1; y <= box.y2; y++) {
+    const unsigned char* p = buf + (y * width + box.x1) * 4 + 3;
+    unsigned char* m = mask + y * width + box.x1;
+    for (int x = box.x1; x <= box.x2; x++, p += 4) *m++ = *p;
+  }
+  BoxBlur<1>(mask, width, height, box,
+             filter.radius_x, filter.radius_y, filter.passes);
+  ShadowJob job;
+  job.buf = buf;
+  job.mask = mask;
+  job.width = width;
+  job.box = box;
+  job.filter = &filter;
+  ParallelFor((box.y2 - box.y1) / kRowsPerBand + 1, DrawShadowRows, &job);
+  LayerPool::Release(mask, width, height, 1);
+}
+
+void Premultiply(unsigned char* buf, int stride, const agg::rect_i& box) {
+  for (int y = box.y1; y <= box.y2; y++) {
+    unsigned char* p = buf + y * stride + box.x1 * 4;
+    for (int x = box.x1; x <= box.x2; x++, p += 4) {
+      const unsigned a = p[3];
+      p[0] = (p[0] * a + 127) / 255;
+      p[1] = (p[1] * a + 127) / 255;
+      p[2] = (p[2] * a + 127) / 255;
+    }
+  }
+}
+
+void Demultiply(unsigned char* buf, int stride, const agg::rect_i& box) {
+  for (int y = box.y1; y <= box.y2; y++) {
+    unsigned char* p = buf + y * stride + box.x1 * 4;
+    for (int x = box.x1; x <= box.x2; x++, p += 4) {
+      const unsigned a = p[3];
+      if (a == 0) {
+        p[0] = p[1] = p[2] = 0;
+        continue;
+      }
+      for (int c = 0; c < 3; c++) {
+        p[c] = std::min(255u, (p[c] * 255 + a / 2) / a);
+      }
+    }
+  }
+}
+
+// Blend functions of the separable modes, on unpremultiplied channels
+// from 0 to 1: b is the backdrop and s the source.
+struct MultiplyOp {
+  static float Apply(float b, float s) { return b * s; }
+};
+struct ScreenOp {
+  static float Apply(float b, float s) { return b + s - b * s; }
+};
+struct LightenOp {
+  static float Apply(float b, float s) { return b > s ? b : s; }
+};
+struct DarkenOp {
+  static float Apply(float b, float s) { return b < s ? b : s; }
+};
+struct DifferenceOp {
+  static float Apply(float b, float s) { return b > s ? b - s : s - b; }
+};
+struct AddOp {
+  static float Apply(float b, float s) { return b + s < 1.0f ? b + s : 1.0f; }
+};
+struct SubtractOp {
+  static float Apply(float b, float s) { return b - s > 0.0f ? b - s : 0.0f; }
+};
+struct HardLightOp {
+  static float Apply(float b, float s) {
+    return s <= 0.5f ? 2.0f * b * s : 1.0f - 2.0f * (1.0f - b) * (1.0f - s);
+  }
+};
+struct OverlayOp {
+  static float Apply(float b, float s) { return HardLightOp::Apply(s, b); }
+};
+
+// Where both are present the blend function decides the color, and
+// elsewhere each shows through as it would with source-over.
+template<class Op>
+void BlendSeparable(const unsigned char* src, unsigned char* dst, int len) {
+  const float k = 1.0f / 255.0f;
+  for (int i = 0; i < len; i++) {
+    const unsigned char* s = src + i * 4;
+    unsigned char* d = dst + i * 4;
+    const float sa = s[3] * k;
+    const float da = d[3] * k;
+    const float both = sa * da;
+    const int oa = (int)((sa + da - both) * 255.0f + 0.5f);
+    // Where oa is 0 so is co. Selects on floats would keep the loop from
+    // being vectorized, so the clamps are done on integers.
+    const float scale = 255.0f * 255.0f / (oa > 1 ? oa : 1);
+    for (int c = 0; c < 3; c++) {
+      const float cs = s[c] * k;
+      const float cb = d[c] * k;
+      const float co = cs * (sa - both) + cb * (da - both) +
+          both * Op::Apply(cb, cs);
+      const int v = (int)(co * scale + 0.5f);
+      d[c] = v < 255 ? v : 255;
+    }
+    d[3] = oa;
+  }
+}
+
+// Inverts the backdrop where the source is.
+void BlendInvert(const unsigned char* src, unsigned char* dst, int len) {
+  for (int i = 0; i < len; i++) {
+    const unsigned sa = src[i * 4 + 3];
+    unsigned char* d = dst + i * 4;
+    for (int c = 0; c < 3; c++) {
+      d[c] = Multiply(d[c], 255 - sa) + Multiply(255 - d[c], sa);
+    }
+  }
+}
+
+// Keeps the backdrop where the source is (alpha) or isn't (erase).
+template<bool kErase>
+void BlendAlpha(const unsigned char* src, unsigned char* dst, int len) {
+  for (int i = 0; i < len; i++) {
+    const unsigned sa = src[i * 4 + 3];
+    dst[i * 4 + 3] = Multiply(dst[i * 4 + 3], kErase ? 255 - sa : sa);
+  }
+}
+
+}  // namespace
+
+unsigned char* LayerPool::Acquire(int width, int height,
+                                  int bytes_per_pixel) {
+  const size_t size = (size_t)width * height * bytes_per_pixel;
+  pthread_mutex_lock(&pool_mutex);
+  for (std::vector<PooledLayer>::iterator it = pool.begin();
+       it != pool.end(); ++it) {
+    if (it->size == size) {
+      unsigned char* buf = it->buf;
+      pool.erase(it);
+      pthread_mutex_unlock(&pool_mutex);
+      return buf;
+    }
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  return static_cast<unsigned char*>(malloc(size));
+}
+
+void LayerPool::Release(unsigned char* buf, int width, int height,
+                        int bytes_per_pixel) {
+  PooledLayer layer;
+  layer.buf = buf;
+  layer.size = (size_t)width * height * bytes_per_pixel;
+  pthread_mutex_lock(&pool_mutex);
+  if (pool.size() < kMaxPooledLayers) {
+    pool.push_back(layer);
+    buf = NULL;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  free(buf);
+}
+
+void FilterLayer(unsigned char* buf, int width, int height,
+                 const std::vector<LayerFilter>& filters) {
+  const agg::rect_i box(0, 0, width - 1, height - 1);
+  const int stride = width * 4;
+  Premultiply(buf, stride, box);
+  for (unsigned i = 0; i < filters.size(); i++) {
+    const LayerFilter& filter = filters[i];
+    if (filter.type == LayerFilter::kBlur) {
+      BoxBlur<4>(buf, width, height, box,
+                 filter.radius_x, filter.radius_y, filter.passes);
+    } else {
+      DrawShadow(buf, width, height, box, filter);
+    }
+  }
+  Demultiply(buf, stride, box);
+}
+
+void BlendSpan(LayerBlend mode, const unsigned char* src, unsigned char* dst,
+               int len) {
+  switch (mode) {
+    case kBlendMultiply: BlendSeparable<MultiplyOp>(src, dst, len); break;
+    case kBlendScreen: BlendSeparable<ScreenOp>(src, dst, len); break;
+    case kBlendLighten: BlendSeparable<LightenOp>(src, dst, len); break;
+    case kBlendDarken: BlendSeparable<DarkenOp>(src, dst, len); break;
+    case kBlendDifference: BlendSeparable<DifferenceOp>(src, dst, len); break;
+    case kBlendAdd: BlendSeparable<AddOp>(src, dst, len); break;
+    case kBlendSubtract: BlendSeparable<SubtractOp>(src, dst, len); break;
+    case kBlendOverlay: BlendSeparable<OverlayOp>(src, dst, len); break;
+    case kBlendHardLight: BlendSeparable<HardLightOp>(src, dst, len); break;
+    case kBlendInvert: BlendInvert(src, dst, len); break;
+    case kBlendAlpha: BlendAlpha<false>(src, dst, len); break;
+    case kBlendErase: BlendAlpha<true>(src, dst, len); break;
+    default: break;
+  }
+}
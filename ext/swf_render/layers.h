@@ -0,0 +1,100 @@
+#ifndef _LAYERS_H
+#define _LAYERS_H
+
+#include <vector>
+
+#include "agg_basics.h"
+#include "agg_color_rgba.h"
+
+// Offscreen buffers for painting a subtree before it is filtered or
+// masked. A layer only covers the part of the frame that is needed, but
+// is addressed in frame coordinates, so shapes are drawn into it just as
+// into the frame itself. Released buffers are kept for the next layer of
+// the same size, so layers don't allocate once a few frames have been
+// drawn.
+class LayerPool {
+public:
+  // Returns an uninitialized width x height buffer, bytes_per_pixel
+  // bytes per pixel.
+  static unsigned char* Acquire(int width, int height, int bytes_per_pixel);
+  static void Release(unsigned char* buf, int width, int height,
+                      int bytes_per_pixel);
+};
+
+// One filter of a layer, in device pixels.
+struct LayerFilter {
+  enum Type {
+    // Box blurs the layer.
+    kBlur,
+    // Draws color where the blurred alpha of the layer, moved by dx and
+    // dy, is. Glows are shadows that aren't moved.
+    kShadow
+  };
+
+  LayerFilter()
+    : type(kBlur),
+      radius_x(0),
+      radius_y(0),
+      passes(0),
+      dx(0),
+      dy(0),
+      strength(256),
+      inner(false),
+      knockout(false),
+      composite_source(true) {}
+
+  // How far the filter can move a pixel.
+  int spread_x() const { return radius_x * passes + (dx < 0 ? -dx : dx); }
+  int spread_y() const { return radius_y * passes + (dy < 0 ? -dy : dy); }
+
+  Type type;
+  int radius_x;
+  int radius_y;
+  int passes;
+  int dx;
+  int dy;
+  agg::rgba8 color;
+  // 8.8 fixed point multiplier of the blurred alpha.
+  int strength;
+  // Draws inside the layer's alpha rather than outside it.
+  bool inner;
+  // Leaves out the layer itself, and for outer shadows, cuts it out of
+  // the shadow.
+  bool knockout;
+  bool composite_source;
+};
+
+// Applies filters in order to the width x height plain RGBA image in
+// buf, the way Flash applies a placement's filter list. Pixels outside
+// the image are taken to be transparent. Blurs are one box blur per pass,
+// as Flash does for the filter's quality, and shadows blur only the alpha
+// channel, once, however they're then colored and moved. Row and column
+// bands are processed in parallel.
+void FilterLayer(unsigned char* buf, int width, int height,
+                 const std::vector<LayerFilter>& filters);
+
+// Flash blend modes, numbered as in PlaceObject3.
+enum LayerBlend {
+  kBlendNormal = 1,
+  kBlendLayer,
+  kBlendMultiply,
+  kBlendScreen,
+  kBlendLighten,
+  kBlendDarken,
+  kBlendDifference,
+  kBlendAdd,
+  kBlendSubtract,
+  kBlendInvert,
+  kBlendAlpha,
+  kBlendErase,
+  kBlendOverlay,
+  kBlendHardLight
+};
+
+// Composites len plain RGBA pixels of src onto those of dst with mode,
+// which isn't normal or layer; those are plain source-over. Each mode has
+// its own branch-free loop, which the compiler vectorizes.
+void BlendSpan(LayerBlend mode, const unsigned char* src, unsigned char* dst,
+               int len);
+
+#endif
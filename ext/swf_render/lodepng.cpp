@@ -1610,7 +1610,8 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize,
+                                     int final)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
@@ -1622,7 +1623,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned BFINAL, BTYPE, LEN, NLEN;
     unsigned char firstbyte;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
@@ -1975,7 +1976,7 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
 }
 
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings)
+                                 const LodePNGCompressSettings* settings, int last)
 {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
@@ -1983,7 +1984,7 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   Hash hash;
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
+  else if(settings->btype == 0) return deflateNoCompression(out, in, insize, last);
   else if(settings->btype == 1) blocksize = insize;
   else /*if(settings->btype == 2)*/
   {
@@ -1999,7 +2000,7 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
 
   for(i = 0; i < numdeflateblocks && !error; i++)
   {
-    int final = i == numdeflateblocks - 1;
+    int final = last && i == numdeflateblocks - 1;
     size_t start = i * blocksize;
     size_t end = start + blocksize;
     if(end > insize) end = insize;
@@ -2008,6 +2009,18 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
   }
 
+  if(!last && !error)
+  {
+    /*empty stored block: BFINAL 0, BTYPE 00, padding to the next byte, LEN 0, NLEN 65535*/
+    addBitToStream(&bp, out, 0);
+    addBitToStream(&bp, out, 0);
+    addBitToStream(&bp, out, 0);
+    ucvector_push_back(out, 0);
+    ucvector_push_back(out, 0);
+    ucvector_push_back(out, 255);
+    ucvector_push_back(out, 255);
+  }
+
   hash_cleanup(&hash);
 
   return error;
@@ -2020,7 +2033,20 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
   unsigned error;
   ucvector v;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_deflatev(&v, in, insize, settings);
+  error = lodepng_deflatev(&v, in, insize, settings, 1);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+unsigned lodepng_deflate_part(unsigned char** out, size_t* outsize,
+                              const unsigned char* in, size_t insize,
+                              const LodePNGCompressSettings* settings, int final)
+{
+  unsigned error;
+  ucvector v;
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = lodepng_deflatev(&v, in, insize, settings, final);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -2046,31 +2072,35 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                  */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
+static unsigned update_adler32(unsigned adler, const unsigned char* data, size_t len)
 {
-   unsigned s1 = adler & 0xffff;
-   unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
 
   while(len > 0)
   {
-    /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
-    unsigned amount = len > 5550 ? 5550 : len;
-    len -= amount;
-    while(amount > 0)
+    /*
+    Over a block of n bytes d[0..n-1], s2 grows by n * s1 + sum((n - i) * d[i]) and s1 by
+    sum(d[i]). Both sums are free of loop carried dependencies, so the compiler vectorizes
+    them. Blocks of 4096 bytes keep them from overflowing.
+    */
+    unsigned n = len > 4096 ? 4096 : len;
+    unsigned sum = 0, weighted = 0, i;
+    for(i = 0; i < n; i++)
     {
-      s1 += (*data++);
-      s2 += s1;
-      amount--;
+      sum += data[i];
+      weighted += (n - i) * data[i];
     }
-    s1 %= 65521;
-    s2 %= 65521;
+    s2 = (s2 + n * s1 + weighted) % 65521;
+    s1 = (s1 + sum) % 65521;
+    data += n;
+    len -= n;
   }
 
   return (s2 << 16) | s1;
 }
 
-/*Return the adler32 of the bytes data[0..len-1]*/
-static unsigned adler32(const unsigned char* data, unsigned len)
+unsigned lodepng_adler32(const unsigned char* data, size_t len)
 {
   return update_adler32(1L, data, len);
 }
@@ -2119,7 +2149,7 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
   if(!settings->ignore_adler32)
   {
     unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-    unsigned checksum = adler32(*out, (unsigned)(*outsize));
+    unsigned checksum = lodepng_adler32(*out, *outsize);
     if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
   }
 
@@ -2169,7 +2199,7 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
 
   if(!error)
   {
-    ADLER32 = adler32(in, (unsigned)insize);
+    ADLER32 = lodepng_adler32(in, insize);
     for(i = 0; i < deflatesize; i++) ucvector_push_back(&outv, deflatedata[i]);
     lodepng_free(deflatedata);
     lodepng_add32bitInt(&outv, ADLER32);
@@ -2308,15 +2338,49 @@ static unsigned lodepng_crc32_table[256] = {
   3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
 };
 
+/*
+Tables for computing the CRC 8 bytes at a time ("slicing by 8"): entry i of table k is
+the CRC contribution of byte value i followed by k zero bytes. Table 0 is lodepng_crc32_table.
+Built once, when the library is loaded.
+*/
+static struct CRC32SliceTables
+{
+  unsigned table[8][256];
+
+  CRC32SliceTables()
+  {
+    unsigned i, k;
+    for(i = 0; i < 256; i++) table[0][i] = lodepng_crc32_table[i];
+    for(k = 1; k < 8; k++)
+    {
+      for(i = 0; i < 256; i++)
+      {
+        unsigned c = table[k - 1][i];
+        table[k][i] = (c >> 8) ^ table[0][c & 0xff];
+      }
+    }
+  }
+} lodepng_crc32_slices;
+
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* buf, size_t len)
 {
   unsigned c = 0xffffffffL;
-  size_t n;
+  const unsigned (*t)[256] = lodepng_crc32_slices.table;
 
-  for(n = 0; n < len; n++)
+  /*8 independent table lookups per 8 bytes, rather than 8 dependent ones*/
+  while(len >= 8)
+  {
+    c ^= buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned)buf[3] << 24);
+    c = t[7][c & 0xff] ^ t[6][(c >> 8) & 0xff] ^ t[5][(c >> 16) & 0xff] ^ t[4][c >> 24]
+      ^ t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+    buf += 8;
+    len -= 8;
+  }
+  while(len > 0)
   {
-    c = lodepng_crc32_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
+    c = t[0][(c ^ *buf++) & 0xff] ^ (c >> 8);
+    len--;
   }
   return c ^ 0xffffffffL;
 }
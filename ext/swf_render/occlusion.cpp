@@ -0,0 +1,89 @@
+#include "occlusion.h"
+
+#include <string.h>
+
+namespace {
+
+bool IsOpaqueSolid(const agg::compound_shape& shape, unsigned style) {
+  const FillStyle& fill = (*shape.m_fill_styles)[style];
+  return fill.type == FillStyle::kSolid && shape.color(style).a == 255;
+}
+
+}  // namespace
+
+OcclusionMask::OcclusionMask(int width, int height)
+  : m_width(width),
+    m_height(height) {}
+
+bool OcclusionMask::CanOcclude(
+    const Shape& shape,
+    const ColorMatrix* color_matrix) {
+  for (std::vector<FillStyle>::const_iterator it = shape.fill_styles.begin();
+       it != shape.fill_styles.end(); ++it) {
+    if (it->type != FillStyle::kSolid) continue;
+    Color c = make_rgba(it->rgba);
+    if (color_matrix) {
+      color_matrix->transform(&c);
+    }
+    if (c.a == 255) return true;
+  }
+  return false;
+}
+
+void OcclusionMask::AddShape(
+    const Shape& shape,
+    const Matrix& transform,
+    const ColorMatrix* color_matrix) {
+  if (m_opaque.empty()) {
+    m_opaque.assign(m_width * m_height, 0);
+  }
+  // Rasterized exactly as DisplayTree::RenderShape fills, so the covers
+  // seen here are the ones that will be painted.
+  agg::compound_shape compound;
+  compound.set_shape(&shape);
+  compound.m_affine = transform;
+  compound.m_color_matrix = color_matrix;
+  while (compound.read_next()) {
+    agg::rasterizer_compound_aa<agg::rasterizer_sl_clip_dbl> rasc;
+    scanline sl;
+    Matrix identity;
+    agg::conv_transform<agg::compound_shape> path(compound, identity);
+    rasc.clip_box(0, 0, m_width, m_height);
+    rasc.reset();
+    rasc.layer_order(agg::layer_direct);
+    for (int i = 0; i < compound.paths(); i++) {
+      rasc.styles(compound.style(i).left_fill,
+                  compound.style(i).right_fill);
+      rasc.add_path(path, compound.style(i).path_id);
+    }
+    if (!rasc.rewind_scanlines()) continue;
+    sl.reset(rasc.min_x(), rasc.max_x());
+    unsigned num_styles;
+    while ((num_styles = rasc.sweep_styles()) > 0) {
+      for (unsigned i = 0; i < num_styles; i++) {
+        if (!IsOpaqueSolid(compound, rasc.style(i))) continue;
+        if (!rasc.sweep_scanline(sl, i)) continue;
+        if (sl.y() < 0 || sl.y() >= m_height) continue;
+        unsigned char* row = &m_opaque[sl.y() * m_width];
+        scanline::const_iterator span = sl.begin();
+        for (unsigned n = sl.num_spans(); n > 0; n--, ++span) {
+          for (int k = 0; k < span->len; k++) {
+            const int x = span->x + k;
+            if (span->covers[k] == agg::cover_full && x >= 0 && x < m_width) {
+              row[x] = 1;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+bool OcclusionMask::Covers(const agg::rect_i& box) const {
+  if (m_opaque.empty()) return false;
+  for (int y = box.y1; y <= box.y2; y++) {
+    const unsigned char* row = &m_opaque[y * m_width];
+    if (memchr(row + box.x1, 0, box.x2 - box.x1 + 1)) return false;
+  }
+  return true;
+}
@@ -0,0 +1,36 @@
+#ifndef _OCCLUSION_H
+#define _OCCLUSION_H
+
+#include <vector>
+
+#include "display_tree.h"
+
+// The device pixels that something painted later is certain to
+// overwrite: pixels fully covered by an opaque solid fill. Painting such
+// a pixel copies the fill color over whatever was underneath, so
+// anything drawn earlier that only touches these pixels can be skipped
+// without changing the output.
+class OcclusionMask {
+public:
+  OcclusionMask(int width, int height);
+
+  // Marks the pixels that shape, drawn at transform through color_matrix,
+  // paints with an opaque solid fill at full coverage.
+  void AddShape(const Shape& shape,
+                const Matrix& transform,
+                const ColorMatrix* color_matrix);
+
+  // True if every pixel of box (inclusive, within the frame) is marked.
+  bool Covers(const agg::rect_i& box) const;
+
+  // True if some fill of shape could mark pixels.
+  static bool CanOcclude(const Shape& shape, const ColorMatrix* color_matrix);
+
+private:
+  int m_width;
+  int m_height;
+  // One byte per pixel, allocated by the first AddShape.
+  std::vector<unsigned char> m_opaque;
+};
+
+#endif
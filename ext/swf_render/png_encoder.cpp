@@ -0,0 +1,452 @@
+#include "png_encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "lodepng.h"
+
+#include "thread_pool.h"
+
+namespace {
+
+// Filtered image data is compressed in pieces of this many bytes, in
+// parallel, when there are at least two of them. Each piece starts with
+// an empty LZ77 window, which for windows of up to 32K costs well under
+// one percent.
+const size_t kDeflatePieceSize = 256 * 1024;
+
+const unsigned kAdlerBase = 65521;
+
+// The Adler-32 of a followed by b, given those of a and b and the length
+// of b, as zlib's adler32_combine computes it.
+unsigned CombineAdler32(unsigned adler_a, unsigned adler_b, size_t len_b) {
+  const unsigned rem = len_b % kAdlerBase;
+  unsigned s1 = adler_a & 0xffff;
+  unsigned s2 = (unsigned)(((unsigned long long)rem * s1) % kAdlerBase);
+  s1 += (adler_b & 0xffff) + kAdlerBase - 1;
+  s2 += (adler_a >> 16) + (adler_b >> 16) + kAdlerBase - rem;
+  if (s1 >= kAdlerBase) s1 -= kAdlerBase;
+  if (s1 >= kAdlerBase) s1 -= kAdlerBase;
+  if (s2 >= kAdlerBase << 1) s2 -= kAdlerBase << 1;
+  if (s2 >= kAdlerBase) s2 -= kAdlerBase;
+  return (s2 << 16) | s1;
+}
+
+struct DeflatePiece {
+  unsigned char* data;
+  size_t size;
+  unsigned adler;
+  unsigned error;
+};
+
+struct DeflateJob {
+  const unsigned char* in;
+  size_t insize;
+  const LodePNGCompressSettings* settings;
+  bool last;
+  std::vector<DeflatePiece> pieces;
+};
+
+void DeflatePieceTask(int i, void* context) {
+  DeflateJob* job = static_cast<DeflateJob*>(context);
+  DeflatePiece& piece = job->pieces[i];
+  const size_t start = i * kDeflatePieceSize;
+  const size_t size = std::min(kDeflatePieceSize, job->insize - start);
+  const bool final = job->last && i == (int)job->pieces.size() - 1;
+  piece.data = NULL;
+  piece.size = 0;
+  piece.error = lodepng_deflate_part(&piece.data, &piece.size,
+                                     job->in + start, size, job->settings,
+                                     final);
+  piece.adler = lodepng_adler32(job->in + start, size);
+}
+
+// Deflates in in pieces, in parallel, appending the deflate data to out
+// and folding the Adler-32 of in into adler. Every piece but the last of
+// the last call ends in a sync flush, so calls can be chained to
+// compress a stream, the way pigz does it.
+unsigned DeflatePieces(const unsigned char* in, size_t insize,
+                       const LodePNGCompressSettings* settings, bool last,
+                       std::vector<unsigned char>* out, unsigned* adler) {
+  DeflateJob job;
+  job.in = in;
+  job.insize = insize;
+  job.settings = settings;
+  job.last = last;
+  job.pieces.resize(std::max<size_t>(
+      1, (insize + kDeflatePieceSize - 1) / kDeflatePieceSize));
+  ParallelFor(job.pieces.size(), DeflatePieceTask, &job);
+  unsigned error = 0;
+  for (size_t i = 0; i < job.pieces.size(); i++) {
+    const DeflatePiece& piece = job.pieces[i];
+    error = error ? error : piece.error;
+    if (!error) {
+      out->insert(out->end(), piece.data, piece.data + piece.size);
+      const size_t start = i * kDeflatePieceSize;
+      *adler = CombineAdler32(*adler, piece.adler,
+                              std::min(kDeflatePieceSize, insize - start));
+    }
+    free(piece.data);
+  }
+  return error;
+}
+
+// The header lodepng_zlib_compress writes: deflate with a 32K window, no
+// dictionary.
+const unsigned char kZlibHeader[2] = {0x78, 0x01};
+
+void AppendBigEndian(unsigned value, std::vector<unsigned char>* out) {
+  out->push_back(value >> 24);
+  out->push_back(value >> 16);
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+// lodepng's custom_zlib hook. Big inputs are deflated in parallel
+// pieces and joined into one zlib stream.
+unsigned ParallelZlibCompress(unsigned char** out, size_t* outsize,
+                              const unsigned char* in, size_t insize,
+                              const LodePNGCompressSettings* settings) {
+  const size_t count = (insize + kDeflatePieceSize - 1) / kDeflatePieceSize;
+  if (count < 2 || ThreadCount() < 2) {
+    LodePNGCompressSettings serial = *settings;
+    serial.custom_zlib = NULL;
+    return lodepng_zlib_compress(out, outsize, in, insize, &serial);
+  }
+  std::vector<unsigned char> zlib(kZlibHeader, kZlibHeader + 2);
+  unsigned adler = 1;
+  unsigned error = DeflatePieces(in, insize, settings, true, &zlib, &adler);
+  if (error) return error;
+  AppendBigEndian(adler, &zlib);
+  unsigned char* data = (unsigned char*)malloc(zlib.size());
+  if (!data) {
+    return 83;  // lodepng's out of memory error.
+  }
+  memcpy(data, &zlib[0], zlib.size());
+  free(*out);
+  *out = data;
+  *outsize = zlib.size();
+  return 0;
+}
+
+unsigned char PaethPredictor(int a, int b, int c) {
+  const int pa = abs(b - c);
+  const int pb = abs(a - c);
+  const int pc = abs(a + b - 2 * c);
+  if (pc < pa && pc < pb) return c;
+  return pb < pa ? b : a;
+}
+
+// Filters length bytes of RGBA row, with the row above it, into out
+// with PNG filter type.
+void FilterRow(int type, const unsigned char* row, const unsigned char* above,
+               int length, unsigned char* out) {
+  switch (type) {
+    case 0:
+      memcpy(out, row, length);
+      break;
+    case 1:
+      for (int i = 0; i < length; i++) {
+        out[i] = row[i] - (i < 4 ? 0 : row[i - 4]);
+      }
+      break;
+    case 2:
+      for (int i = 0; i < length; i++) {
+        out[i] = row[i] - above[i];
+      }
+      break;
+    case 3:
+      for (int i = 0; i < length; i++) {
+        out[i] = row[i] - (((i < 4 ? 0 : row[i - 4]) + above[i]) >> 1);
+      }
+      break;
+    case 4:
+      for (int i = 0; i < length; i++) {
+        out[i] = row[i] - (i < 4 ? above[i] :
+                           PaethPredictor(row[i - 4], above[i], above[i - 4]));
+      }
+      break;
+  }
+}
+
+// Sum of the filtered bytes taken as signed, the PNG spec's heuristic
+// for which filter compresses best.
+unsigned SignedSum(const unsigned char* filtered, int length) {
+  unsigned sum = 0;
+  for (int i = 0; i < length; i++) {
+    sum += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+  }
+  return sum;
+}
+
+// Colors of an image with at most 256 of them, and the index of each
+// pixel's color.
+class Palette {
+public:
+  // Returns false, having looked at as few pixels as it can, if rgba
+  // holds more than 256 colors.
+  bool Build(const unsigned char* rgba, int count) {
+    // Open addressing in twice as many slots as colors, keyed by the
+    // packed pixel. Runs of one color, which flat vector art is mostly
+    // made of, skip the lookup.
+    const int kSlots = 512;
+    unsigned keys[kSlots];
+    short slots[kSlots];
+    memset(slots, -1, sizeof(slots));
+    m_indices.resize(count);
+    m_colors.clear();
+    const unsigned* pixels = reinterpret_cast<const unsigned*>(rgba);
+    unsigned previous = 0;
+    unsigned char index = 0;
+    for (int i = 0; i < count; i++) {
+      const unsigned pixel = pixels[i];
+      if (pixel != previous || i == 0) {
+        unsigned slot = (pixel * 0x9e3779b1u) >> 23;
+        while (slots[slot] >= 0 && keys[slot] != pixel) {
+          slot = (slot + 1) & (kSlots - 1);
+        }
+        if (slots[slot] < 0) {
+          if (m_colors.size() == 256) return false;
+          keys[slot] = pixel;
+          slots[slot] = m_colors.size();
+          m_colors.push_back(pixel);
+        }
+        index = slots[slot];
+        previous = pixel;
+      }
+      m_indices[i] = index;
+    }
+    SortTranslucentFirst();
+    return true;
+  }
+
+  // Adds the colors to mode, which must be LCT_PALETTE.
+  unsigned AddTo(LodePNGColorMode* mode) const {
+    unsigned error = 0;
+    for (size_t i = 0; i < m_colors.size() && !error; i++) {
+      const unsigned char* c =
+          reinterpret_cast<const unsigned char*>(&m_colors[i]);
+      error = lodepng_palette_add(mode, c[0], c[1], c[2], c[3]);
+    }
+    return error;
+  }
+
+  const unsigned char* indices() const {
+    return m_indices.empty() ? NULL : &m_indices[0];
+  }
+
+private:
+  // tRNS only stores alpha up to the last translucent color, so those go
+  // first.
+  void SortTranslucentFirst() {
+    unsigned char remap[256];
+    std::vector<unsigned> sorted;
+    for (int opaque = 0; opaque < 2; opaque++) {
+      for (size_t i = 0; i < m_colors.size(); i++) {
+        const unsigned char* c =
+            reinterpret_cast<const unsigned char*>(&m_colors[i]);
+        if ((c[3] == 255) == (opaque == 1)) {
+          remap[i] = sorted.size();
+          sorted.push_back(m_colors[i]);
+        }
+      }
+    }
+    m_colors.swap(sorted);
+    for (size_t i = 0; i < m_indices.size(); i++) {
+      m_indices[i] = remap[m_indices[i]];
+    }
+  }
+
+  std::vector<unsigned> m_colors;
+  std::vector<unsigned char> m_indices;
+};
+
+void ConfigureEncoder(PngCompression compression,
+                      LodePNGEncoderSettings* settings) {
+  LodePNGCompressSettings& zlib = settings->zlibsettings;
+  zlib.custom_zlib = ParallelZlibCompress;
+  switch (compression) {
+    case kPngFast:
+      zlib.windowsize = 256;
+      zlib.nicematch = 32;
+      zlib.lazymatching = 0;
+      // Paeth for every row, rather than trying all five per row.
+      settings->filter_strategy = LFS_PREDEFINED;
+      settings->filter_palette_zero = 0;
+      // Checking every pixel for a smaller color type costs about as
+      // much as it saves.
+      settings->auto_convert = LAC_NO;
+      break;
+    case kPngDefault:
+      break;
+    case kPngSmall:
+      zlib.windowsize = 32768;
+      zlib.nicematch = 258;
+      zlib.lazymatching = 1;
+      settings->filter_strategy = LFS_ENTROPY;
+      break;
+  }
+}
+
+}  // namespace
+
+bool ParsePngCompression(const char* name, PngCompression* compression) {
+  if (!strcmp(name, "fast")) {
+    *compression = kPngFast;
+  } else if (!strcmp(name, "default")) {
+    *compression = kPngDefault;
+  } else if (!strcmp(name, "small")) {
+    *compression = kPngSmall;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+unsigned EncodePng(const unsigned char* rgba, int width, int height,
+                   PngCompression compression,
+                   unsigned char** out, size_t* size) {
+  LodePNGState state;
+  lodepng_state_init(&state);
+  state.info_raw.colortype = LCT_RGBA;
+  state.info_raw.bitdepth = 8;
+  state.info_png.color.colortype = LCT_RGBA;
+  state.info_png.color.bitdepth = 8;
+  ConfigureEncoder(compression, &state.encoder);
+  // Images of up to 256 colors are written with a palette, as 8 bit
+  // indices, unless lodepng is to search every color type for the
+  // smallest.
+  Palette palette;
+  const unsigned char* pixels = rgba;
+  unsigned error = 0;
+  if (compression != kPngSmall && palette.Build(rgba, width * height)) {
+    state.info_raw.colortype = LCT_PALETTE;
+    state.info_png.color.colortype = LCT_PALETTE;
+    error = palette.AddTo(&state.info_raw);
+    if (!error) {
+      error = palette.AddTo(&state.info_png.color);
+    }
+    state.encoder.auto_convert = LAC_NO;
+    // Filters don't help indices. Matches are mostly with the row above
+    // instead, so the window has to reach it.
+    state.encoder.filter_strategy = LFS_ZERO;
+    unsigned& window = state.encoder.zlibsettings.windowsize;
+    while (window <= (unsigned)width && window < 32768) {
+      window *= 2;
+    }
+    pixels = palette.indices();
+  }
+  std::vector<unsigned char> filters;
+  if (state.encoder.filter_strategy == LFS_PREDEFINED) {
+    filters.assign(height, 4);
+    state.encoder.predefined_filters = filters.empty() ? NULL : &filters[0];
+  }
+  *out = NULL;
+  *size = 0;
+  if (!error) {
+    error = lodepng_encode(out, size, pixels, width, height, &state);
+  }
+  lodepng_state_cleanup(&state);
+  return error;
+}
+
+PngStreamWriter::PngStreamWriter(FILE* file, int width, int height,
+                                 PngCompression compression)
+  : m_file(file),
+    m_width(width),
+    m_height(height),
+    m_compression(compression),
+    m_rows(0),
+    m_adler(1),
+    m_error(0),
+    m_above(width * 4, 0) {
+  LodePNGEncoderSettings settings;
+  lodepng_encoder_settings_init(&settings);
+  ConfigureEncoder(compression, &settings);
+  m_settings = settings.zlibsettings;
+  static const unsigned char kSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  if (fwrite(kSignature, 1, 8, m_file) != 8) {
+    m_error = 79;
+  }
+  unsigned char header[13];
+  for (int i = 0; i < 4; i++) {
+    header[i] = width >> (24 - 8 * i);
+    header[4 + i] = height >> (24 - 8 * i);
+  }
+  header[8] = 8;  // Bits per channel.
+  header[9] = 6;  // RGBA.
+  header[10] = 0;  // Deflate.
+  header[11] = 0;  // Adaptive filtering.
+  header[12] = 0;  // Not interlaced.
+  WriteChunk("IHDR", header, 13);
+}
+
+unsigned PngStreamWriter::WriteRows(const unsigned char* rgba, int count) {
+  if (m_error) return m_error;
+  const int length = m_width * 4;
+  count = std::min(count, m_height - m_rows);
+  if (count <= 0) return 0;
+  m_filtered.resize((size_t)count * (length + 1));
+  m_trials.resize(5 * length);
+  unsigned char* trial = &m_trials[0];
+  const unsigned char* above = &m_above[0];
+  for (int y = 0; y < count; y++) {
+    const unsigned char* row = rgba + (size_t)y * length;
+    unsigned char* out = &m_filtered[(size_t)y * (length + 1)];
+    if (m_compression == kPngFast) {
+      // Paeth for every row, as EncodePng does.
+      out[0] = 4;
+      FilterRow(4, row, above, length, out + 1);
+    } else {
+      int best = 0;
+      unsigned best_sum = 0;
+      for (int type = 0; type < 5; type++) {
+        FilterRow(type, row, above, length, trial + type * length);
+        const unsigned sum = SignedSum(trial + type * length, length);
+        if (type == 0 || sum < best_sum) {
+          best = type;
+          best_sum = sum;
+        }
+      }
+      out[0] = best;
+      memcpy(out + 1, trial + best * length, length);
+    }
+    above = row;
+  }
+  memcpy(&m_above[0], above, length);
+  m_rows += count;
+  const bool last = m_rows == m_height;
+  m_chunk.clear();
+  if (m_rows == count) {
+    m_chunk.insert(m_chunk.end(), kZlibHeader, kZlibHeader + 2);
+  }
+  m_error = DeflatePieces(&m_filtered[0], m_filtered.size(), &m_settings, last,
+                          &m_chunk, &m_adler);
+  if (m_error) return m_error;
+  if (last) {
+    AppendBigEndian(m_adler, &m_chunk);
+  }
+  WriteChunk("IDAT", &m_chunk[0], m_chunk.size());
+  if (last) {
+    WriteChunk("IEND", NULL, 0);
+  }
+  return m_error;
+}
+
+void PngStreamWriter::WriteChunk(const char* type, const unsigned char* data,
+                                 size_t size) {
+  if (m_error) return;
+  // The CRC covers the type and the data.
+  std::vector<unsigned char> chunk;
+  AppendBigEndian(size, &chunk);
+  chunk.insert(chunk.end(), type, type + 4);
+  if (size) {
+    chunk.insert(chunk.end(), data, data + size);
+  }
+  AppendBigEndian(lodepng_crc32(&chunk[4], size + 4), &chunk);
+  if (fwrite(&chunk[0], 1, chunk.size(), m_file) != chunk.size()) {
+    m_error = 79;  // lodepng's error for a file that can't be written.
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef _PNGENCODER_H
+#define _PNGENCODER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+#include "lodepng.h"
+
+// How hard EncodePng works at making the output small. lodepng's
+// defaults are tuned for size, and at 1024 pixels and up encoding can
+// take longer than rendering.
+enum PngCompression {
+  // For latency sensitive requests: a short window, greedy matching and
+  // one filter for every row. Files come out somewhat bigger.
+  kPngFast,
+  // lodepng's own settings.
+  kPngDefault,
+  // For offline batch jobs: the whole window, lazy matching and the
+  // filter that gives the smallest entropy for each row.
+  kPngSmall
+};
+
+// Parses "fast", "default" or "small". Returns false for anything else.
+bool ParsePngCompression(const char* name, PngCompression* compression);
+
+// Encodes the width x height plain RGBA image in rgba as a PNG in *out,
+// which the caller frees. Returns a lodepng error code.
+unsigned EncodePng(const unsigned char* rgba, int width, int height,
+                   PngCompression compression,
+                   unsigned char** out, size_t* size);
+
+// Writes a PNG to a file a band of rows at a time, so that only one band
+// of a big image has to be in memory. Each band is filtered and deflated
+// as it comes, in parallel pieces. Rows are always written as 8 bit
+// RGBA, as there is no telling in advance whether a palette would do.
+class PngStreamWriter {
+public:
+  // Writes the PNG signature and header to file, which stays the
+  // caller's.
+  PngStreamWriter(FILE* file, int width, int height,
+                  PngCompression compression);
+
+  // Appends the next count rows of plain RGBA pixels, width * 4 bytes
+  // apart. The image is ended once all height rows are in. Returns a
+  // lodepng error code. Once a call has failed, later calls do nothing
+  // and return the same error.
+  unsigned WriteRows(const unsigned char* rgba, int count);
+
+private:
+  void WriteChunk(const char* type, const unsigned char* data, size_t size);
+
+  FILE* m_file;
+  const int m_width;
+  const int m_height;
+  const PngCompression m_compression;
+  LodePNGCompressSettings m_settings;
+  int m_rows;
+  unsigned m_adler;
+  unsigned m_error;
+  // The last row written, to filter the next one against.
+  std::vector<unsigned char> m_above;
+  std::vector<unsigned char> m_filtered;
+  // Each row filtered every way, to pick from.
+  std::vector<unsigned char> m_trials;
+  std::vector<unsigned char> m_chunk;
+};
+
+#endif
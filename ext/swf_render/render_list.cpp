@@ -0,0 +1,537 @@
+#include "render_list.h"
+
+#include <math.h>
+
+#include "bitmap_cache.h"
+#include "clip_mask.h"
+#include "occlusion.h"
+
+#include "shape_coverage.h"
+
+// What a Paint call does with each item.
+struct RenderList::PaintJob {
+  PaintJob(int clip_width, int clip_height)
+    : clip_width(clip_width),
+      clip_height(clip_height),
+      box(NULL),
+      record(NULL),
+      replay(NULL),
+      first(0),
+      dx(0),
+      dy(0) {}
+
+  int clip_width;
+  int clip_height;
+  // If set, items whose bounds miss box are skipped.
+  const agg::rect_i* box;
+  // If set, the coverage of every item is appended to record.
+  std::vector<ShapeCoverage*>* record;
+  // If set, item i is painted from (*replay)[i - first].
+  const std::vector<ShapeCoverage*>* replay;
+  int first;
+  // Items are painted moved by whole pixels, into a cached bitmap.
+  int dx;
+  int dy;
+};
+
+namespace {
+
+// Bigger cacheAsBitmap subtrees are painted like any other layer, as
+// Flash stops caching at about this size.
+const int kMaxCachedBitmapSide = 4096;
+const int kMaxCachedBitmapPixels = 1 << 22;
+
+// Appends what decides how item paints when moved by (dx, dy).
+void AppendSignature(const RenderItem& item, int layer, int dx, int dy,
+                     std::vector<double>* signature) {
+  signature->push_back(item.node->index);
+  signature->push_back(item.layer - layer);
+  signature->push_back(item.clip);
+  Matrix m(item.transform);
+  m.tx += dx;
+  m.ty += dy;
+  double t[6];
+  m.store_to(t);
+  signature->insert(signature->end(), t, t + 6);
+  if (item.color_matrix) {
+    const float* c = item.color_matrix->m;
+    signature->insert(signature->end(), c, c + 20);
+  }
+  signature->push_back(item.color_matrix != NULL);
+}
+
+}  // namespace
+
+void RenderList::Build(
+    const DisplayTree& tree,
+    const SpecOverlay* overlay,
+    const Matrix& view_transform) {
+  items.clear();
+  layers.clear();
+  m_layer = -1;
+  tree.Flatten(view_transform, NULL, overlay, this);
+}
+
+void RenderList::Add(
+    const DisplayTree* node,
+    const Matrix& transform,
+    const ColorMatrix* color_matrix) {
+  RenderItem item;
+  item.node = node;
+  item.layer = m_layer;
+  item.clip = false;
+  item.transform = transform;
+  item.color_matrix = color_matrix;
+
+  const Shape& shape = *node->shape;
+  const Rect& r = shape.shape_bounds;
+  double x[4] = { double(r.x_min), double(r.x_max), double(r.x_max), double(r.x_min) };
+  double y[4] = { double(r.y_min), double(r.y_min), double(r.y_max), double(r.y_max) };
+  double x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+  for (int i = 0; i < 4; i++) {
+    transform.transform(&x[i], &y[i]);
+    x1 = i ? std::min(x1, x[i]) : x[i];
+    y1 = i ? std::min(y1, y[i]) : y[i];
+    x2 = i ? std::max(x2, x[i]) : x[i];
+    y2 = i ? std::max(y2, y[i]) : y[i];
+  }
+  // shape_bounds should already include the strokes, but hairlines are
+  // drawn a pixel wide whatever the scale, so don't rely on it.
+  double pad = 2.0;
+  for (std::vector<LineStyle>::const_iterator it = shape.line_styles.begin();
+       it != shape.line_styles.end(); ++it) {
+    const double width = it->width == 1 ? 1.0 : it->width * transform.scale();
+    pad = std::max(pad, width + 2.0);
+  }
+  // Filters can move the pixels of the shape.
+  double pad_x = pad;
+  double pad_y = pad;
+  for (int l = m_layer; l >= 0; l = layers[l].parent) {
+    pad_x += layers[l].spread_x;
+    pad_y += layers[l].spread_y;
+  }
+  item.bounds = agg::rect_i((int)floor(x1 - pad_x), (int)floor(y1 - pad_y),
+                            (int)ceil(x2 + pad_x), (int)ceil(y2 + pad_y));
+  items.push_back(item);
+}
+
+bool RenderList::PushLayer(
+    const DisplayTree* node,
+    const Placement& placement,
+    const Matrix& transform) {
+  const std::vector<Filter>& filters = placement.filters;
+  // Blur sizes and distances are in pixels, which are 20 twips.
+  const double scale = transform.scale() * 20.0;
+  RenderLayer layer;
+  layer.node = node;
+  layer.parent = m_layer;
+  layer.clip = false;
+  layer.cached = placement.cache_as_bitmap;
+  layer.blend = placement.blend_mode > kBlendNormal &&
+      placement.blend_mode <= kBlendHardLight ?
+      LayerBlend(placement.blend_mode) : kBlendNormal;
+  layer.spread_x = 0;
+  layer.spread_y = 0;
+  for (std::vector<Filter>::const_iterator it = filters.begin();
+       it != filters.end(); ++it) {
+    const Filter& filter = *it;
+    LayerFilter f;
+    if (filter.filter_type == Filter::kFilterBlur) {
+      f.type = LayerFilter::kBlur;
+    } else if (filter.filter_type == Filter::kFilterGlow ||
+               filter.filter_type == Filter::kFilterDropShadow) {
+      f.type = LayerFilter::kShadow;
+    } else {
+      continue;
+    }
+    f.radius_x = std::max(agg::iround(filter.blur_x * scale / 2.0), 0);
+    f.radius_y = std::max(agg::iround(filter.blur_y * scale / 2.0), 0);
+    f.passes = filter.passes;
+    if (f.type == LayerFilter::kBlur) {
+      if (f.passes == 0 || (f.radius_x == 0 && f.radius_y == 0)) continue;
+    } else {
+      f.dx = agg::iround(cos(filter.angle) * filter.distance * scale);
+      f.dy = agg::iround(sin(filter.angle) * filter.distance * scale);
+      f.color = make_rgba(filter.rgba);
+      f.strength = agg::iround(filter.strength * 256.0);
+      f.inner = filter.inner;
+      f.knockout = filter.knockout;
+      f.composite_source = filter.composite_source;
+    }
+    layer.filters.push_back(f);
+    layer.spread_x += f.spread_x();
+    layer.spread_y += f.spread_y();
+  }
+  if (layer.filters.empty() && layer.blend == kBlendNormal &&
+      !layer.cached) {
+    return false;
+  }
+  m_layer = layers.size();
+  layers.push_back(layer);
+  return true;
+}
+
+void RenderList::PushMask(
+    const DisplayTree* node,
+    const Matrix& transform,
+    const SpecOverlay* overlay) {
+  RenderLayer layer;
+  layer.node = node;
+  layer.parent = m_layer;
+  layer.clip = true;
+  layer.cached = false;
+  layer.blend = kBlendNormal;
+  layer.spread_x = 0;
+  layer.spread_y = 0;
+  m_layer = layers.size();
+  layers.push_back(layer);
+
+  RenderList mask;
+  node->Flatten(transform, NULL, overlay, &mask);
+  for (std::vector<RenderItem>::iterator it = mask.items.begin();
+       it != mask.items.end(); ++it) {
+    RenderItem item = *it;
+    item.layer = m_layer;
+    item.clip = true;
+    item.color_matrix = NULL;
+    // The mask decides where the enclosing layers' filters spread from.
+    for (int l = m_layer; l >= 0; l = layers[l].parent) {
+      item.bounds.x1 -= layers[l].spread_x;
+      item.bounds.y1 -= layers[l].spread_y;
+      item.bounds.x2 += layers[l].spread_x;
+      item.bounds.y2 += layers[l].spread_y;
+    }
+    items.push_back(item);
+  }
+}
+
+void RenderList::PopLayer() {
+  m_layer = layers[m_layer].parent;
+}
+
+// Smaller shapes are unlikely to hide anything and not worth the extra
+// rasterization.
+static const int kMinOccluderArea = 32 * 32;
+
+int RenderList::Cull(int width, int height) {
+  const agg::rect_i frame(0, 0, width - 1, height - 1);
+  OcclusionMask mask(width, height);
+  std::vector<bool> keep(items.size(), true);
+  int culled = 0;
+  // Front to back, so the mask holds everything painted above the item.
+  for (int i = items.size() - 1; i >= 0; i--) {
+    const RenderItem& item = items[i];
+    const agg::rect_i box = agg::intersect_rectangles(item.bounds, frame);
+    if (!box.is_valid() || mask.Covers(box)) {
+      keep[i] = false;
+      ++culled;
+      continue;
+    }
+    // Blurred shapes don't fully cover anything.
+    if (item.layer >= 0 ||
+        (box.x2 - box.x1 + 1) * (box.y2 - box.y1 + 1) < kMinOccluderArea ||
+        !OcclusionMask::CanOcclude(*item.node->shape, item.color_matrix)) {
+      continue;
+    }
+    for (int j = 0; j < i; j++) {
+      if (agg::intersect_rectangles(items[j].bounds, box).is_valid()) {
+        mask.AddShape(*item.node->shape, item.transform, item.color_matrix);
+        break;
+      }
+    }
+  }
+  if (culled) {
+    int n = 0;
+    for (int i = 0; i < items.size(); i++) {
+      if (keep[i]) items[n++] = items[i];
+    }
+    items.resize(n);
+  }
+  return culled;
+}
+
+void RenderList::Render(
+    int begin, int end,
+    int clip_width, int clip_height,
+    renderer_base& ren_base,
+    renderer_scanline& ren) const {
+  PaintJob job(clip_width, clip_height);
+  Paint(job, begin, end, -1, ren_base, ren);
+}
+
+void RenderList::RenderIntersecting(
+    const agg::rect_i& box,
+    int clip_width, int clip_height,
+    renderer_base& ren_base,
+    renderer_scanline& ren) const {
+  PaintJob job(clip_width, clip_height);
+  job.box = &box;
+  Paint(job, 0, items.size(), -1, ren_base, ren);
+}
+
+void RenderList::Record(
+    int begin, int end,
+    int clip_width, int clip_height,
+    renderer_base& ren_base,
+    renderer_scanline& ren,
+    std::vector<ShapeCoverage*>* coverage) const {
+  PaintJob job(clip_width, clip_height);
+  job.record = coverage;
+  Paint(job, begin, end, -1, ren_base, ren);
+}
+
+void RenderList::Replay(
+    int begin, int end,
+    const std::vector<ShapeCoverage*>& coverage,
+    renderer_base& ren_base,
+    renderer_scanline& ren) const {
+  PaintJob job(ren_base.width(), ren_base.height());
+  job.replay = &coverage;
+  job.first = begin;
+  Paint(job, begin, end, -1, ren_base, ren);
+}
+
+void RenderList::Paint(
+    const PaintJob& job,
+    int begin, int end,
+    int layer,
+    renderer_base& ren_base,
+    renderer_scanline& ren) const {
+  int i = begin;
+  while (i < end) {
+    const int child = ChildLayer(items[i].layer, layer);
+    if (child < 0) {
+      PaintItem(job, i, ren_base, ren);
+      ++i;
+      continue;
+    }
+    int j = i + 1;
+    while (j < end && InLayer(items[j].layer, child)) {
+      ++j;
+    }
+    PaintLayer(job, i, j, child, ren_base);
+    i = j;
+  }
+}
+
+void RenderList::PaintLayer(
+    const PaintJob& job,
+    int begin, int end,
+    int layer,
+    renderer_base& ren_base) const {
+  const RenderLayer& l = layers[layer];
+  if (l.cached && PaintCachedLayer(job, begin, end, layer, ren_base)) {
+    return;
+  }
+  // Only the part of the layer that the filters can move into what
+  // ren_base paints is needed. Nothing is drawn outside the bounds of its
+  // items, or of its mask.
+  agg::rect_i region(ren_base.xmin() - l.spread_x, ren_base.ymin() - l.spread_y,
+                     ren_base.xmax() + l.spread_x, ren_base.ymax() + l.spread_y);
+  region = agg::intersect_rectangles(
+      region, agg::rect_i(0, 0, job.clip_width - 1, job.clip_height - 1));
+  agg::rect_i bounds(1, 1, 0, 0);
+  agg::rect_i mask_bounds(1, 1, 0, 0);
+  for (int i = begin; i < end; i++) {
+    const bool mask = items[i].clip && items[i].layer == layer;
+    agg::rect_i& b = mask ? mask_bounds : bounds;
+    const agg::rect_i item_bounds = ItemBounds(job, i);
+    b = b.is_valid() ? agg::unite_rectangles(b, item_bounds) : item_bounds;
+  }
+  region = agg::intersect_rectangles(region, bounds);
+  if (l.clip) {
+    region = agg::intersect_rectangles(region, mask_bounds);
+  }
+  if (!bounds.is_valid() || (l.clip && !mask_bounds.is_valid()) ||
+      !region.is_valid()) {
+    // Recorded coverage must still line up with the items.
+    for (int i = begin; job.record && i < end; i++) {
+      job.record->push_back(new ShapeCoverage());
+    }
+    return;
+  }
+
+  // The buffer only holds region, but rows are addressed from the origin
+  // of the frame, so shapes are drawn into it at their usual device
+  // coordinates. layer_base never strays outside region.
+  const int width = region.x2 - region.x1 + 1;
+  const int height = region.y2 - region.y1 + 1;
+  unsigned char* buf = LayerPool::Acquire(width, height, 4);
+  agg::rendering_buffer rbuf;
+  rbuf.attach(buf - (region.y1 * width + region.x1) * 4,
+              region.x2 + 1, region.y2 + 1, width * 4);
+  pixfmt pixf(rbuf);
+  renderer_base layer_base(pixf);
+  layer_base.clip_box(region.x1, region.y1, region.x2, region.y2);
+  layer_base.copy_bar(region.x1, region.y1, region.x2, region.y2,
+                      Color(0, 0, 0, 0));
+  renderer_scanline layer_ren(layer_base);
+  Paint(job, begin, end, layer, layer_base, layer_ren);
+  if (!l.filters.empty()) {
+    FilterLayer(buf, width, height, l.filters);
+  }
+  CompositeLayer(job, begin, end, layer, pixf, region, ren_base);
+  LayerPool::Release(buf, width, height, 4);
+}
+
+bool RenderList::PaintCachedLayer(
+    const PaintJob& job,
+    int begin, int end,
+    int layer,
+    renderer_base& ren_base) const {
+  const RenderLayer& l = layers[layer];
+  agg::rect_i bounds = ItemBounds(job, begin);
+  for (int i = begin + 1; i < end; i++) {
+    bounds = agg::unite_rectangles(bounds, ItemBounds(job, i));
+  }
+  const int width = bounds.x2 - bounds.x1 + 1;
+  const int height = bounds.y2 - bounds.y1 + 1;
+  if (width > kMaxCachedBitmapSide || height > kMaxCachedBitmapSide ||
+      width * height > kMaxCachedBitmapPixels) {
+    return false;
+  }
+  // The bitmap is painted whole, whatever part of it is needed, so it
+  // can be reused at any whole pixel offset. It is the same however the
+  // frame is split up.
+  const agg::rect_i region =
+      agg::intersect_rectangles(bounds, ren_base.clip_box());
+  if (region.is_valid()) {
+    PaintJob bitmap_job(width, height);
+    bitmap_job.dx = job.dx - bounds.x1;
+    bitmap_job.dy = job.dy - bounds.y1;
+    std::vector<double> signature;
+    signature.push_back(width);
+    signature.push_back(height);
+    for (int i = begin; i < end; i++) {
+      AppendSignature(items[i], layer, bitmap_job.dx, bitmap_job.dy,
+                      &signature);
+    }
+    const CachedBitmap* bitmap = BitmapCache::Acquire(l.node, signature);
+    if (!bitmap) {
+      CachedBitmap* built = new CachedBitmap(width, height);
+      agg::rendering_buffer rbuf;
+      rbuf.attach(&built->pixels[0], width, height, width * 4);
+      pixfmt pixf(rbuf);
+      renderer_base bitmap_base(pixf);
+      renderer_scanline bitmap_ren(bitmap_base);
+      Paint(bitmap_job, begin, end, layer, bitmap_base, bitmap_ren);
+      if (!l.filters.empty()) {
+        FilterLayer(&built->pixels[0], width, height, l.filters);
+      }
+      bitmap = BitmapCache::Insert(l.node, signature, built);
+    }
+    // Addressed like the layers of PaintLayer.
+    agg::rendering_buffer rbuf;
+    rbuf.attach(const_cast<unsigned char*>(&bitmap->pixels[0]) -
+                    (bounds.y1 * width + bounds.x1) * 4,
+                bounds.x2 + 1, bounds.y2 + 1, width * 4);
+    pixfmt pixf(rbuf);
+    CompositeLayer(job, begin, end, layer, pixf, region, ren_base);
+    BitmapCache::Release(bitmap);
+  }
+  for (int i = begin; job.record && i < end; i++) {
+    job.record->push_back(new ShapeCoverage());
+  }
+  return true;
+}
+
+void RenderList::CompositeLayer(
+    const PaintJob& job,
+    int begin, int end,
+    int layer,
+    const pixfmt& pixf,
+    const agg::rect_i& region,
+    renderer_base& ren_base) const {
+  const RenderLayer& l = layers[layer];
+  if (l.clip) {
+    ClipMask mask(job.clip_width, job.clip_height, region);
+    for (int i = begin; i < end; i++) {
+      if (items[i].clip && items[i].layer == layer) {
+        Matrix transform(items[i].transform);
+        transform.tx += job.dx;
+        transform.ty += job.dy;
+        mask.AddShape(*items[i].node->shape, transform);
+      }
+    }
+    mask.Blend(pixf, ren_base);
+  } else if (l.blend == kBlendNormal || l.blend == kBlendLayer) {
+    ren_base.blend_from(pixf, &region);
+  } else {
+    const agg::rect_i box =
+        agg::intersect_rectangles(region, ren_base.clip_box());
+    for (int y = box.y1; y <= box.y2; y++) {
+      BlendSpan(l.blend, pixf.pix_ptr(box.x1, y),
+                ren_base.ren().pix_ptr(box.x1, y), box.x2 - box.x1 + 1);
+    }
+  }
+}
+
+void RenderList::PaintItem(
+    const PaintJob& job,
+    int i,
+    renderer_base& ren_base,
+    renderer_scanline& ren) const {
+  const RenderItem& item = items[i];
+  if (item.clip) {
+    // Masks are applied by PaintLayer, not painted.
+    if (job.record) {
+      job.record->push_back(new ShapeCoverage());
+    }
+    return;
+  }
+  if (job.replay) {
+    (*job.replay)[i - job.first]->Replay(item.transform, item.color_matrix,
+                                         ren_base, ren);
+    return;
+  }
+  if (job.box &&
+      !agg::intersect_rectangles(ItemBounds(job, i), *job.box).is_valid()) {
+    return;
+  }
+  Matrix transform(item.transform);
+  transform.tx += job.dx;
+  transform.ty += job.dy;
+  ShapeCoverage* coverage = job.record ? new ShapeCoverage() : NULL;
+  DisplayTree::RenderShape(*item.node->shape, transform,
+                           item.color_matrix, job.clip_width, job.clip_height,
+                           ren_base, ren, coverage);
+  if (coverage) {
+    job.record->push_back(coverage);
+  }
+}
+
+agg::rect_i RenderList::ItemBounds(const PaintJob& job, int i) const {
+  const agg::rect_i& b = items[i].bounds;
+  return agg::rect_i(b.x1 + job.dx, b.y1 + job.dy, b.x2 + job.dx, b.y2 + job.dy);
+}
+
+int RenderList::ChildLayer(int item_layer, int layer) const {
+  if (item_layer == layer) return -1;
+  while (layers[item_layer].parent != layer) {
+    item_layer = layers[item_layer].parent;
+  }
+  return item_layer;
+}
+
+bool RenderList::InLayer(int item_layer, int layer) const {
+  for (int l = item_layer; l >= 0; l = layers[l].parent) {
+    if (l == layer) return true;
+  }
+  return false;
+}
+
+int RenderList::FirstItemAtOrAfter(int node) const {
+  int i = 0;
+  while (i < items.size() && items[i].node->index < node) {
+    ++i;
+  }
+  if (i == items.size() || items[i].layer < 0) return i;
+  int outermost = items[i].layer;
+  while (layers[outermost].parent >= 0) {
+    outermost = layers[outermost].parent;
+  }
+  while (i > 0 && InLayer(items[i - 1].layer, outermost)) {
+    --i;
+  }
+  return i;
+}
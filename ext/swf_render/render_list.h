@@ -0,0 +1,156 @@
+#ifndef _RENDERLIST_H
+#define _RENDERLIST_H
+
+#include <vector>
+
+#include "display_tree.h"
+#include "layers.h"
+
+class ShapeCoverage;
+
+// One shape to be drawn, with everything inherited from its ancestors
+// already resolved.
+struct RenderItem {
+  const DisplayTree* node;
+  // Innermost layer the shape is painted into, or -1 to paint it
+  // straight into the frame.
+  int layer;
+  // True for the shapes of a clipping placement, which make up the mask
+  // of their layer rather than being painted.
+  bool clip;
+  // Maps shape coordinates to device pixels.
+  Matrix transform;
+  const ColorMatrix* color_matrix;
+  // Device pixels the shape may touch, inclusive, allowing for strokes,
+  // anti-aliasing and the blur of the layers it is in.
+  agg::rect_i bounds;
+};
+
+// A subtree that is painted offscreen and filtered or masked before
+// being drawn into the layer or frame underneath. Its items are
+// consecutive.
+struct RenderLayer {
+  const DisplayTree* node;
+  // Enclosing layer, or -1.
+  int parent;
+  // True if the layer's first items are the mask the rest are shown
+  // through.
+  bool clip;
+  // True if the layer is painted through BitmapCache.
+  bool cached;
+  std::vector<LayerFilter> filters;
+  // How the filtered layer is composited.
+  LayerBlend blend;
+  // How far the filters can move a pixel.
+  int spread_x;
+  int spread_y;
+};
+
+// The visible shapes of a display tree under one overlay and view
+// transform, in paint order. Items point into the tree and the overlay,
+// which must outlive the list.
+class RenderList {
+public:
+  RenderList() : m_layer(-1) {}
+
+  void Build(const DisplayTree& tree,
+             const SpecOverlay* overlay,
+             const Matrix& view_transform);
+
+  // Appends an item, working out its device bounds.
+  void Add(const DisplayTree* node,
+           const Matrix& transform,
+           const ColorMatrix* color_matrix);
+
+  // Items added until the matching PopLayer go into a layer with the
+  // blur, glow and drop shadow filters and the blend mode of placement,
+  // scaled by transform. Returns false, without starting a layer, if it
+  // would paint the same as drawing the items straight through.
+  bool PushLayer(const DisplayTree* node,
+                 const Placement& placement,
+                 const Matrix& transform);
+  // Items added until the matching PopLayer go into a layer clipped to
+  // the fills of node, a clipping placement, drawn at transform.
+  void PushMask(const DisplayTree* node,
+                const Matrix& transform,
+                const SpecOverlay* overlay);
+  void PopLayer();
+
+  // Drops the items that would be painted entirely outside the frame or
+  // entirely under opaque fills painted after them, which leaves the
+  // rendered pixels unchanged. Returns the number of items dropped.
+  int Cull(int width, int height);
+
+  // Paints items [begin, end) back to front.
+  void Render(int begin, int end,
+              int clip_width, int clip_height,
+              renderer_base& ren_base,
+              renderer_scanline& ren) const;
+
+  // Paints, back to front, the items whose bounds intersect box. The
+  // caller is expected to have clipped ren_base to box.
+  void RenderIntersecting(const agg::rect_i& box,
+                          int clip_width, int clip_height,
+                          renderer_base& ren_base,
+                          renderer_scanline& ren) const;
+
+  // As Render, also recording the coverage of each item. coverage
+  // receives one entry per item, owned by the caller.
+  void Record(int begin, int end,
+              int clip_width, int clip_height,
+              renderer_base& ren_base,
+              renderer_scanline& ren,
+              std::vector<ShapeCoverage*>* coverage) const;
+
+  // Paints items [begin, end) from coverage recorded by a list with the
+  // same items at the same transforms. Only the color matrices are taken
+  // from this list.
+  void Replay(int begin, int end,
+              const std::vector<ShapeCoverage*>& coverage,
+              renderer_base& ren_base,
+              renderer_scanline& ren) const;
+
+  // Index of the first item whose node index is at least node, or size().
+  // If that item is in a layer, the first item of its outermost layer is
+  // returned instead, so that the layer is painted as a whole.
+  int FirstItemAtOrAfter(int node) const;
+
+  int size() const { return items.size(); }
+
+  std::vector<RenderItem> items;
+  std::vector<RenderLayer> layers;
+
+private:
+  struct PaintJob;
+
+  // Paints items [begin, end), which are all inside layer (-1 for the
+  // frame), into ren_base.
+  void Paint(const PaintJob& job, int begin, int end, int layer,
+             renderer_base& ren_base, renderer_scanline& ren) const;
+  // Paints items [begin, end) into an offscreen copy of layer, filters
+  // it and draws the result into ren_base.
+  void PaintLayer(const PaintJob& job, int begin, int end, int layer,
+                  renderer_base& ren_base) const;
+  // As PaintLayer, for a cached layer, going through BitmapCache. Returns
+  // false if the layer is too big to cache.
+  bool PaintCachedLayer(const PaintJob& job, int begin, int end, int layer,
+                        renderer_base& ren_base) const;
+  // Composites the finished layer, addressed in the coordinates of
+  // ren_base, over region.
+  void CompositeLayer(const PaintJob& job, int begin, int end, int layer,
+                      const pixfmt& pixf, const agg::rect_i& region,
+                      renderer_base& ren_base) const;
+  void PaintItem(const PaintJob& job, int i,
+                 renderer_base& ren_base, renderer_scanline& ren) const;
+  // The outermost layer holding item_layer that is inside layer, or -1
+  // if item_layer is layer itself.
+  int ChildLayer(int item_layer, int layer) const;
+  // Bounds of item i where job paints it.
+  agg::rect_i ItemBounds(const PaintJob& job, int i) const;
+  bool InLayer(int item_layer, int layer) const;
+
+  // The layer items are being added to during Build.
+  int m_layer;
+};
+
+#endif
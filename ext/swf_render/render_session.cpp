@@ -0,0 +1,103 @@
+#include "render_session.h"
+
+#include <string.h>
+
+#include "agg_rendering_buffer.h"
+
+namespace {
+
+bool SameColor(const ColorMatrix* a, const ColorMatrix* b) {
+  if (a == b) return true;
+  if (a == NULL || b == NULL) return false;
+  return memcmp(a->m, b->m, sizeof(a->m)) == 0;
+}
+
+void Include(const agg::rect_i& r, agg::rect_i* dirty) {
+  *dirty = dirty->is_valid() ? agg::unite_rectangles(*dirty, r) : r;
+}
+
+}  // namespace
+
+RenderSession::RenderSession(const Document* document,
+                             const DisplayTree* tree,
+                             const RunConfig& config)
+  : m_document(document),
+    m_tree(tree),
+    m_config(config),
+    m_overlay(NULL),
+    m_width(0),
+    m_height(0),
+    m_last_dirty(1, 1, 0, 0) {}
+
+RenderSession::~RenderSession() {
+  delete m_overlay;
+  Document::Release(m_document);
+}
+
+agg::rect_i RenderSession::DirtyRect(const RenderList& next) const {
+  // Both lists are in node order, so matching items up is a merge.
+  agg::rect_i dirty(1, 1, 0, 0);
+  int i = 0;
+  int j = 0;
+  while (i < m_list.size() || j < next.size()) {
+    const RenderItem* before = i < m_list.size() ? &m_list.items[i] : NULL;
+    const RenderItem* after = j < next.size() ? &next.items[j] : NULL;
+    if (after == NULL ||
+        (before != NULL && before->node->index < after->node->index)) {
+      Include(before->bounds, &dirty);
+      ++i;
+    } else if (before == NULL || after->node->index < before->node->index) {
+      Include(after->bounds, &dirty);
+      ++j;
+    } else {
+      if (!before->transform.is_equal(after->transform, 0.0) ||
+          !SameColor(before->color_matrix, after->color_matrix)) {
+        Include(before->bounds, &dirty);
+        Include(after->bounds, &dirty);
+      }
+      ++i;
+      ++j;
+    }
+  }
+  return dirty;
+}
+
+void RenderSession::Update(
+    SpecOverlay* overlay,
+    int width,
+    int height,
+    const Matrix& view_transform) {
+  RenderList next;
+  next.Build(*m_tree, overlay, view_transform);
+
+  const agg::rect_i frame(0, 0, width - 1, height - 1);
+  agg::rect_i dirty;
+  if (m_overlay == NULL || width != m_width || height != m_height ||
+      !view_transform.is_equal(m_view_transform, 0.0)) {
+    m_pixels.assign(width * height * 4, 0);
+    dirty = frame;
+  } else {
+    dirty = agg::intersect_rectangles(DirtyRect(next), frame);
+  }
+
+  if (dirty.is_valid()) {
+    agg::rendering_buffer rbuf;
+    rbuf.attach(&m_pixels[0], width, height, width * 4);
+    pixfmt pixf(rbuf);
+    renderer_base ren_base(pixf);
+    ren_base.clip_box(dirty.x1, dirty.y1, dirty.x2, dirty.y2);
+    ren_base.copy_bar(dirty.x1, dirty.y1, dirty.x2, dirty.y2, Color(0, 0, 0, 0));
+    renderer_scanline ren(ren_base);
+    next.RenderIntersecting(dirty, width, height, ren_base, ren);
+  }
+
+  // The old list points into the old overlay, so replace it first.
+  m_list.items.swap(next.items);
+  m_list.layers.swap(next.layers);
+  delete m_overlay;
+  m_overlay = overlay;
+  m_width = width;
+  m_height = height;
+  m_view_transform = view_transform;
+  m_last_dirty = dirty;
+}
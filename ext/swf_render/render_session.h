@@ -0,0 +1,63 @@
+#ifndef _RENDERSESSION_H
+#define _RENDERSESSION_H
+
+#include <vector>
+
+#include "display_tree.h"
+#include "document.h"
+#include "render_list.h"
+#include "utils.h"
+
+// Renders one tree at one requested size over and over, keeping the last
+// frame and its render list. A new overlay is compared with the previous
+// one item by item, and only the pixels under the items that appeared,
+// disappeared, moved or changed color are painted again.
+//
+// Not thread safe; use one session per caller.
+class RenderSession {
+public:
+  // Takes over the caller's reference to document, which tree belongs
+  // to.
+  RenderSession(const Document* document, const DisplayTree* tree,
+                const RunConfig& config);
+  ~RenderSession();
+
+  // Brings the frame up to date with overlay, which the session takes
+  // ownership of, rendered at width x height through view_transform.
+  // Falls back to a full render when those differ from the previous
+  // frame's, e.g. because the overall bounds changed.
+  void Update(SpecOverlay* overlay,
+              int width,
+              int height,
+              const Matrix& view_transform);
+
+  const DisplayTree& tree() const { return *m_tree; }
+  const RunConfig& config() const { return m_config; }
+  const unsigned char* pixels() const {
+    return m_pixels.empty() ? NULL : &m_pixels[0];
+  }
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  const Matrix& view_transform() const { return m_view_transform; }
+
+  // The region painted by the last Update, or an invalid rect if nothing
+  // needed painting.
+  const agg::rect_i& last_dirty() const { return m_last_dirty; }
+
+private:
+  agg::rect_i DirtyRect(const RenderList& next) const;
+
+  const Document* m_document;
+  const DisplayTree* m_tree;
+  RunConfig m_config;
+
+  SpecOverlay* m_overlay;
+  RenderList m_list;
+  std::vector<unsigned char> m_pixels;
+  int m_width;
+  int m_height;
+  Matrix m_view_transform;
+  agg::rect_i m_last_dirty;
+};
+
+#endif
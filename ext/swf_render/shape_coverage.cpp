@@ -0,0 +1,139 @@
+#include "shape_coverage.h"
+
+namespace {
+
+typedef ShapeCoverage::Pass Pass;
+
+// Reads scanlines back out of a pass. Unlike the storages' own
+// sweep_scanline() this keeps its cursor here, so any number of readers
+// can share one pass.
+class PassReader {
+public:
+  explicit PassReader(const Pass& pass)
+    : m_pass(pass), m_next_aa(0), m_next_bin(0) {}
+
+  bool ReadAA(scanline& sl) {
+    if (m_next_aa >= m_pass.num_aa) return false;
+    const agg::scanline_storage_aa8::scanline_data& data =
+        m_pass.aa.scanline_by_index(m_next_aa++);
+    sl.reset_spans();
+    for (unsigned i = 0; i < data.num_spans; i++) {
+      const agg::scanline_storage_aa8::span_data& span =
+          m_pass.aa.span_by_index(data.start_span + i);
+      const agg::int8u* covers = m_pass.aa.covers_by_index(span.covers_id);
+      if (span.len < 0) {
+        sl.add_span(span.x, unsigned(-span.len), *covers);
+      } else {
+        sl.add_cells(span.x, span.len, covers);
+      }
+    }
+    sl.finalize(data.y);
+    return true;
+  }
+
+  bool ReadBin(agg::scanline_bin& sl) {
+    if (m_next_bin >= m_pass.num_bin) return false;
+    const agg::scanline_storage_bin::scanline_data& data =
+        m_pass.bin.scanline_by_index(m_next_bin++);
+    sl.reset_spans();
+    for (unsigned i = 0; i < data.num_spans; i++) {
+      const agg::scanline_storage_bin::span_data& span =
+          m_pass.bin.span_by_index(data.start_span + i);
+      sl.add_span(span.x, span.len, agg::cover_full);
+    }
+    sl.finalize(data.y);
+    return true;
+  }
+
+private:
+  const Pass& m_pass;
+  unsigned m_next_aa;
+  unsigned m_next_bin;
+};
+
+// Replays a pass into render_scanlines_compound in place of the
+// compound rasterizer that recorded it.
+class PassReplayer {
+public:
+  explicit PassReplayer(const Pass& pass)
+    : m_pass(pass),
+      m_reader(pass),
+      m_next_sweep(0),
+      m_next_styles(0),
+      m_first_style(0),
+      m_next_style(0) {}
+
+  bool rewind_scanlines() { return m_pass.has_scanlines; }
+  int min_x() const { return m_pass.min_x; }
+  int max_x() const { return m_pass.max_x; }
+
+  unsigned sweep_styles() {
+    const unsigned num_styles = m_pass.num_styles[m_next_styles++];
+    m_first_style = m_next_style;
+    m_next_style += num_styles;
+    return num_styles;
+  }
+
+  unsigned style(unsigned style_idx) const {
+    return m_pass.styles[m_first_style + style_idx];
+  }
+
+  bool sweep_scanline(scanline& sl, int) {
+    return m_pass.swept[m_next_sweep++] && m_reader.ReadAA(sl);
+  }
+
+  bool sweep_scanline(agg::scanline_bin& sl, int) {
+    return m_pass.swept[m_next_sweep++] && m_reader.ReadBin(sl);
+  }
+
+private:
+  const Pass& m_pass;
+  PassReader m_reader;
+  unsigned m_next_sweep;
+  unsigned m_next_styles;
+  unsigned m_first_style;
+  unsigned m_next_style;
+};
+
+}  // namespace
+
+ShapeCoverage::~ShapeCoverage() {
+  for (std::vector<Pass*>::iterator it = m_passes.begin();
+       it != m_passes.end(); ++it) {
+    delete *it;
+  }
+}
+
+ShapeCoverage::Pass* ShapeCoverage::AddPass(
+    const std::vector<FillStyle>* fill_styles,
+    const std::vector<const LineStyle*>& strokes) {
+  Pass* pass = new Pass();
+  pass->fill_styles = fill_styles;
+  pass->strokes = strokes;
+  m_passes.push_back(pass);
+  return pass;
+}
+
+void ShapeCoverage::Replay(
+    const Matrix& transform,
+    const ColorMatrix* color_matrix,
+    renderer_base& ren_base,
+    renderer_scanline& ren) const {
+  agg::compound_shape shape;
+  shape.m_affine = transform;
+  shape.m_color_matrix = color_matrix;
+  scanline sl;
+  agg::scanline_bin sl_bin;
+  agg::span_allocator<Color> alloc;
+  for (std::vector<Pass*>::const_iterator it = m_passes.begin();
+       it != m_passes.end(); ++it) {
+    const Pass& pass = **it;
+    shape.m_fill_styles = pass.fill_styles;
+    shape.m_strokes = pass.strokes;
+    PassReplayer replayer(pass);
+    agg::render_scanlines_compound(
+        replayer, sl, sl_bin, ren_base, alloc, shape, pass.strokes.size());
+    pass.hairlines.Draw(
+        color_matrix, pass.clip_width, pass.clip_height, ren_base);
+  }
+}
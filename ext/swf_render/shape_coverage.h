@@ -0,0 +1,145 @@
+#ifndef _SHAPECOVERAGE_H
+#define _SHAPECOVERAGE_H
+
+#include <vector>
+
+#include "agg_scanline_storage_aa.h"
+#include "agg_scanline_storage_bin.h"
+
+#include "display_tree.h"
+#include "hairlines.h"
+
+// The anti-aliased coverage of one shape at one transform, captured
+// while the shape is rasterized. Coverage depends only on the outlines
+// and the transform, so replaying it with another color matrix paints
+// exactly what rasterizing the shape again would, without touching the
+// outlines.
+class ShapeCoverage {
+public:
+  // What the compound rasterizer produced for one group of the shape.
+  struct Pass {
+    Pass()
+      : fill_styles(NULL),
+        clip_width(0),
+        clip_height(0),
+        has_scanlines(false),
+        min_x(0),
+        max_x(0),
+        num_aa(0),
+        num_bin(0) {}
+
+    const std::vector<FillStyle>* fill_styles;
+    // Line styles of the strokes rasterized along with the fills.
+    std::vector<const LineStyle*> strokes;
+    // Hairlines drawn after the rasterizer, and the frame they were
+    // clipped to.
+    Hairlines hairlines;
+    int clip_width;
+    int clip_height;
+
+    bool has_scanlines;
+    int min_x;
+    int max_x;
+    // Result of every sweep_styles() call, including the final 0, and
+    // the styles each one made current.
+    std::vector<unsigned> num_styles;
+    std::vector<unsigned> styles;
+    // Result of every sweep_scanline() call, in order. The scanlines
+    // that were produced are stored below, also in order.
+    std::vector<bool> swept;
+    agg::scanline_storage_aa8 aa;
+    agg::scanline_storage_bin bin;
+    unsigned num_aa;
+    unsigned num_bin;
+  };
+
+  ~ShapeCoverage();
+
+  Pass* AddPass(const std::vector<FillStyle>* fill_styles,
+                const std::vector<const LineStyle*>& strokes);
+
+  // Paints the recorded coverage. transform must be the one the coverage
+  // was recorded at; color_matrix may differ. Safe to call from several
+  // threads at once.
+  void Replay(const Matrix& transform,
+              const ColorMatrix* color_matrix,
+              renderer_base& ren_base,
+              renderer_scanline& ren) const;
+
+private:
+  std::vector<Pass*> m_passes;
+};
+
+namespace agg
+{
+    // Stands in for a compound rasterizer in render_scanlines_compound,
+    // forwarding every call and recording the answers in a pass.
+    template<class Rasterizer> class coverage_recorder
+    {
+    public:
+        coverage_recorder(Rasterizer& ras, ShapeCoverage::Pass* pass) :
+            m_ras(ras),
+            m_pass(pass)
+        {}
+
+        bool rewind_scanlines()
+        {
+            m_pass->has_scanlines = m_ras.rewind_scanlines();
+            if(m_pass->has_scanlines)
+            {
+                m_pass->min_x = m_ras.min_x();
+                m_pass->max_x = m_ras.max_x();
+            }
+            return m_pass->has_scanlines;
+        }
+
+        int min_x() const { return m_ras.min_x(); }
+        int max_x() const { return m_ras.max_x(); }
+
+        unsigned sweep_styles()
+        {
+            unsigned num_styles = m_ras.sweep_styles();
+            m_pass->num_styles.push_back(num_styles);
+            for(unsigned i = 0; i < num_styles; i++)
+            {
+                m_pass->styles.push_back(m_ras.style(i));
+            }
+            return num_styles;
+        }
+
+        unsigned style(unsigned style_idx) const
+        {
+            return m_ras.style(style_idx);
+        }
+
+        bool sweep_scanline(scanline_u8& sl, int style_idx)
+        {
+            bool swept = m_ras.sweep_scanline(sl, style_idx);
+            m_pass->swept.push_back(swept);
+            if(swept)
+            {
+                m_pass->aa.render(sl);
+                m_pass->num_aa++;
+            }
+            return swept;
+        }
+
+        bool sweep_scanline(scanline_bin& sl, int style_idx)
+        {
+            bool swept = m_ras.sweep_scanline(sl, style_idx);
+            m_pass->swept.push_back(swept);
+            if(swept)
+            {
+                m_pass->bin.render(sl);
+                m_pass->num_bin++;
+            }
+            return swept;
+        }
+
+    private:
+        Rasterizer& m_ras;
+        ShapeCoverage::Pass* m_pass;
+    };
+}
+
+#endif
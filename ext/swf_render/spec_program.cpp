@@ -0,0 +1,198 @@
+#include "spec_program.h"
+#include "display_tree.h"
+#include "document.h"
+
+#include <cstdlib>
+#include <string.h>
+
+static const char kNewline = '\n';
+static const char kSingleQuote = '\'';
+static const char kColon = ':';
+static const char kEquals = '=';
+static const char kParam = '$';
+
+static const int kMaxToken = 100;
+
+namespace {
+
+void ApplyModifier(const Modifier& mod, int node, SpecOverlay* overlay) {
+  if (mod.has_color) {
+    unsigned r = (mod.rgb >> 16) & 0xFF;
+    unsigned g = (mod.rgb >> 8) & 0xFF;
+    unsigned b = (mod.rgb & 0xFF);
+    if (mod.has_alpha) {
+      overlay->SetColor(node, r, g, b, mod.a);
+    } else {
+      overlay->SetColor(node, r, g, b);
+    }
+  }
+  SpecOverlay::NodeOverride* target = overlay->Get(node);
+  if (mod.r != 0) {
+    target->matrix.rotate(mod.r);
+  }
+  if (mod.sx != 1.0 || mod.sy != 1.0) {
+    target->matrix.scale(mod.sx, mod.sy);
+  }
+  if (mod.has_visible) {
+    target->visible = mod.v;
+  }
+}
+
+// Colors are written as '0xRRGGBB', optionally without the quote.
+unsigned ParseColor(const char* value) {
+  const char* v = value;
+  if (*v == kSingleQuote) ++v;
+  if (v[0] == '0' && (v[1] == 'x' || v[1] == 'X')) v += 2;
+  return strtoul(v, NULL, 16);
+}
+
+}  // namespace
+
+SpecProgram::SpecProgram(const DisplayTree& tree, const char* spec) {
+  bool at_start = true;
+  bool has_target = false;
+  int num_props = 0;
+  Op op;
+  const char* c = spec;
+  while (*c) {
+    if (at_start) {
+      if (*c == kColon) {
+        if (has_target && num_props) {
+          m_ops.push_back(op);
+        }
+        const DisplayTree* target = tree.DescendantByPath(c + 1);
+        has_target = target != NULL;
+        op = Op();
+        op.node = has_target ? target->index : -1;
+        for (int i = 0; i < kNumProperties; i++) {
+          op.params[i] = -1;
+        }
+        num_props = 0;
+      } else if (has_target) {
+        ParseProperty(c, &op);
+        num_props++;
+      }
+      at_start = false;
+    }
+    if (*c == kNewline) {
+      at_start = true;
+    }
+    ++c;
+  }
+  if (has_target && num_props) {
+    m_ops.push_back(op);
+  }
+}
+
+void SpecProgram::ParseProperty(const char* property, Op* op) {
+  const char* c = property;
+  char key[kMaxToken];
+  char value[kMaxToken];
+  char* n = key;
+  char* end = key + kMaxToken - 1;
+  bool in_value = false;
+  value[0] = '\0';
+  while (*c && *c != kNewline) {
+    if (*c == kEquals && !in_value) {
+      *n = '\0';
+      n = value;
+      end = value + kMaxToken - 1;
+      in_value = true;
+    } else if (n < end) {
+      *n = *c;
+      ++n;
+    }
+    ++c;
+  }
+  *n = '\0';
+
+  Modifier* modifier = &op->modifier;
+  const int slot = value[0] == kParam ? ParamSlot(value + 1) : -1;
+  if (strcmp(key, "v") == 0) {
+    op->params[kVisible] = slot;
+    if (slot < 0) {
+      modifier->v = value[0] == 't';
+      modifier->has_visible = true;
+    }
+  } else if (strcmp(key, "c") == 0) {
+    op->params[kColor] = slot;
+    if (slot < 0) {
+      modifier->rgb = ParseColor(value);
+      modifier->has_color = true;
+    }
+  } else if (strcmp(key, "s") == 0) {
+    op->params[kScaleX] = slot;
+    op->params[kScaleY] = slot;
+    if (slot < 0) {
+      modifier->sx = strtod(value, NULL);
+      modifier->sy = modifier->sx;
+    }
+  } else if (strcmp(key, "sx") == 0) {
+    op->params[kScaleX] = slot;
+    if (slot < 0) modifier->sx = strtod(value, NULL);
+  } else if (strcmp(key, "sy") == 0) {
+    op->params[kScaleY] = slot;
+    if (slot < 0) modifier->sy = strtod(value, NULL);
+  } else if (strcmp(key, "r") == 0) {
+    op->params[kRotation] = slot;
+    if (slot < 0) modifier->r = strtod(value, NULL);
+  } else if (strcmp(key, "a") == 0) {
+    op->params[kAlpha] = slot;
+    if (slot < 0) {
+      modifier->a = strtod(value, NULL);
+      modifier->has_alpha = true;
+    }
+  }
+}
+
+int SpecProgram::ParamSlot(const char* name) {
+  const int existing = ParamIndex(name);
+  if (existing >= 0) return existing;
+  m_param_names.push_back(name);
+  return m_param_names.size() - 1;
+}
+
+int SpecProgram::ParamIndex(const char* name) const {
+  for (int i = 0; i < m_param_names.size(); i++) {
+    if (m_param_names[i] == name) return i;
+  }
+  return -1;
+}
+
+CompiledSpec::~CompiledSpec() {
+  // The tree belongs to the document.
+  delete program;
+  if (document) Document::Release(document);
+}
+
+void SpecProgram::Apply(SpecOverlay* overlay, const SpecArgs* args) const {
+  for (std::vector<Op>::const_iterator it = m_ops.begin();
+       it != m_ops.end(); ++it) {
+    Modifier mod = it->modifier;
+    if (args) {
+      const int* p = it->params;
+      if (p[kVisible] >= 0 && args->IsSet(p[kVisible])) {
+        mod.v = args->Get(p[kVisible]) != 0;
+        mod.has_visible = true;
+      }
+      if (p[kColor] >= 0 && args->IsSet(p[kColor])) {
+        mod.rgb = (unsigned)args->Get(p[kColor]);
+        mod.has_color = true;
+      }
+      if (p[kAlpha] >= 0 && args->IsSet(p[kAlpha])) {
+        mod.a = args->Get(p[kAlpha]);
+        mod.has_alpha = true;
+      }
+      if (p[kScaleX] >= 0 && args->IsSet(p[kScaleX])) {
+        mod.sx = args->Get(p[kScaleX]);
+      }
+      if (p[kScaleY] >= 0 && args->IsSet(p[kScaleY])) {
+        mod.sy = args->Get(p[kScaleY]);
+      }
+      if (p[kRotation] >= 0 && args->IsSet(p[kRotation])) {
+        mod.r = args->Get(p[kRotation]);
+      }
+    }
+    ApplyModifier(mod, it->node, overlay);
+  }
+}
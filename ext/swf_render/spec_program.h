@@ -0,0 +1,115 @@
+#ifndef _SPECPROGRAM_H
+#define _SPECPROGRAM_H
+
+#include <string>
+#include <vector>
+
+class DisplayTree;
+class Document;
+class SpecOverlay;
+
+// The modifications a spec makes to a single node.
+struct Modifier {
+  Modifier()
+    : sx(1.0),
+      sy(1.0),
+      r(0.0),
+      rgb(0),
+      a(1.0),
+      v(true),
+      has_visible(false),
+      has_color(false),
+      has_alpha(false){}
+  double sx;
+  double sy;
+  double r;
+  unsigned rgb;
+  double a;
+  bool v;
+  bool has_visible;
+  bool has_color;
+  bool has_alpha;
+};
+
+class SpecArgs;
+
+// A spec compiled against a display tree. Every ':path.to.child' is
+// resolved to a node index and every property is parsed into its typed
+// field once, so the program can be applied to any tree built from the
+// same sprite without looking at the spec text again.
+//
+// A property whose value is written as $name is a parameter. Its value
+// is supplied per application through SpecArgs; if it is not supplied
+// the property is left out, as though the spec never mentioned it.
+class SpecProgram {
+public:
+  enum Property {
+    kVisible,
+    kColor,
+    kAlpha,
+    kScaleX,
+    kScaleY,
+    kRotation,
+    kNumProperties
+  };
+
+  SpecProgram(const DisplayTree& tree, const char* spec);
+
+  // Records the program's modifications in overlay, which must belong to
+  // the tree the program was compiled against. args may be NULL.
+  void Apply(SpecOverlay* overlay, const SpecArgs* args) const;
+
+  // Returns the slot of parameter $name, or -1 if the spec has no such
+  // parameter.
+  int ParamIndex(const char* name) const;
+
+  int num_params() const { return m_param_names.size(); }
+  const std::string& param_name(int i) const { return m_param_names[i]; }
+
+private:
+  struct Op {
+    int node;
+    Modifier modifier;
+    // Parameter slot feeding each property, or -1.
+    int params[kNumProperties];
+  };
+
+  void ParseProperty(const char* property, Op* op);
+  int ParamSlot(const char* name);
+
+  std::vector<Op> m_ops;
+  std::vector<std::string> m_param_names;
+};
+
+// Parameter values for one application of a SpecProgram.
+class SpecArgs {
+public:
+  explicit SpecArgs(const SpecProgram& program)
+    : m_set(program.num_params(), false),
+      m_values(program.num_params(), 0.0) {}
+
+  void Set(int slot, double value) {
+    if (slot < 0 || slot >= (int)m_values.size()) return;
+    m_set[slot] = true;
+    m_values[slot] = value;
+  }
+  bool IsSet(int slot) const { return m_set[slot]; }
+  double Get(int slot) const { return m_values[slot]; }
+
+private:
+  std::vector<bool> m_set;
+  std::vector<double> m_values;
+};
+
+// A program together with the cached tree it was compiled against, so
+// that it can be rendered over and over without reparsing the SWF. Holds
+// a reference to the tree's document, released on destruction.
+struct CompiledSpec {
+  CompiledSpec() : document(NULL), tree(NULL), program(NULL) {}
+  ~CompiledSpec();
+  const Document* document;
+  const DisplayTree* tree;
+  SpecProgram* program;
+};
+
+#endif
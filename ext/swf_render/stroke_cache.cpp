@@ -0,0 +1,102 @@
+#include "stroke_cache.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+
+#include "thread_pool.h"
+
+namespace {
+
+// About 17MB of vertices.
+const unsigned kMaxCachedVertices = 1 << 20;
+
+struct StrokeKey {
+  StrokeKey(const Shape* shape, const Matrix& transform) : shape(shape) {
+    transform.store_to(m);
+  }
+  bool operator<(const StrokeKey& other) const {
+    if (shape != other.shape) return shape < other.shape;
+    return memcmp(m, other.m, sizeof(m)) < 0;
+  }
+  const Shape* shape;
+  double m[6];
+};
+
+typedef std::map<StrokeKey, StrokedOutlines*> StrokeMap;
+
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+StrokeMap cache;
+// Keys in the order they were inserted, for eviction.
+std::deque<StrokeKey> insertion_order;
+unsigned cached_vertices = 0;
+
+}  // namespace
+
+const StrokedOutlines* StrokeCache::Acquire(
+    const Shape* shape,
+    const Matrix& transform) {
+  ScopedLock lock(&cache_mutex);
+  StrokeMap::iterator it = cache.find(StrokeKey(shape, transform));
+  if (it == cache.end()) return NULL;
+  it->second->m_shared.refs++;
+  return it->second;
+}
+
+const StrokedOutlines* StrokeCache::Insert(
+    const Shape* shape,
+    const Matrix& transform,
+    StrokedOutlines* outlines) {
+  const StrokeKey key(shape, transform);
+  ScopedLock lock(&cache_mutex);
+  StrokeMap::iterator it = cache.find(key);
+  if (it != cache.end()) {
+    delete outlines;
+    it->second->m_shared.refs++;
+    return it->second;
+  }
+  outlines->m_shared.refs = 1;
+  cache[key] = outlines;
+  insertion_order.push_back(key);
+  cached_vertices += outlines->total_vertices();
+  while (cached_vertices > kMaxCachedVertices && insertion_order.size() > 1) {
+    it = cache.find(insertion_order.front());
+    insertion_order.pop_front();
+    StrokedOutlines* evicted = it->second;
+    cached_vertices -= evicted->total_vertices();
+    cache.erase(it);
+    if (evicted->m_shared.Evict()) delete evicted;
+  }
+  return outlines;
+}
+
+void StrokeCache::Purge(const std::vector<Shape>& shapes) {
+  if (shapes.empty()) return;
+  const Shape* begin = &shapes[0];
+  const Shape* end = begin + shapes.size();
+  std::less<const Shape*> less;
+  ScopedLock lock(&cache_mutex);
+  std::deque<StrokeKey> kept;
+  for (std::deque<StrokeKey>::const_iterator it = insertion_order.begin();
+       it != insertion_order.end(); ++it) {
+    if (less(it->shape, begin) || !less(it->shape, end)) {
+      kept.push_back(*it);
+      continue;
+    }
+    StrokeMap::iterator entry = cache.find(*it);
+    StrokedOutlines* purged = entry->second;
+    cached_vertices -= purged->total_vertices();
+    cache.erase(entry);
+    if (purged->m_shared.Evict()) delete purged;
+  }
+  insertion_order.swap(kept);
+}
+
+void StrokeCache::Release(const StrokedOutlines* outlines) {
+  StrokedOutlines* entry = const_cast<StrokedOutlines*>(outlines);
+  ScopedLock lock(&cache_mutex);
+  if (entry->m_shared.Release()) delete entry;
+}
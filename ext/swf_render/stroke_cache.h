@@ -0,0 +1,68 @@
+#ifndef _STROKECACHE_H
+#define _STROKECACHE_H
+
+#include <vector>
+
+#include "agg_path_storage.h"
+
+#include "display_tree.h"
+#include "thread_pool.h"
+
+// The stroked polygons of one shape at one transform, in the order
+// DisplayTree::RenderShape strokes its paths. Strokes are computed in
+// device space, so they depend only on the outlines, the line styles and
+// the transform; feeding the stored vertices to a rasterizer gives
+// exactly what running agg::conv_stroke again would.
+class StrokedOutlines {
+public:
+  StrokedOutlines() {}
+
+  // Appends the outline vs produces for path_id.
+  template<class VertexSource>
+  void Add(VertexSource& vs, unsigned path_id) {
+    m_ids.push_back(m_paths.start_new_path());
+    m_paths.concat_path(vs, path_id);
+  }
+
+  // The stored outlines, to be read with an agg::path_storage_reader.
+  const agg::path_storage& paths() const { return m_paths; }
+  // The path id to rewind a reader to for the index'th outline.
+  unsigned path_id(unsigned index) const { return m_ids[index]; }
+  unsigned size() const { return m_ids.size(); }
+  unsigned total_vertices() const { return m_paths.total_vertices(); }
+
+private:
+  friend class StrokeCache;
+
+  agg::path_storage m_paths;
+  std::vector<unsigned> m_ids;
+  SharedEntry m_shared;
+};
+
+// Process wide cache of stroked outlines keyed by shape and transform,
+// so shapes rendered again at the same transform (by other tiles, other
+// variants, a render session or a repeated request) skip stroking.
+// Oldest entries are dropped once the cache holds too many vertices.
+class StrokeCache {
+public:
+  // Returns the outlines stored for shape at transform, or NULL. The
+  // caller must hand a non-NULL result back to Release.
+  static const StrokedOutlines* Acquire(const Shape* shape,
+                                        const Matrix& transform);
+
+  // Stores outlines, which the cache takes ownership of, for shape at
+  // transform. If another thread stored the same entry first, outlines is
+  // deleted and that entry is returned instead. Either way the result
+  // must be handed back to Release.
+  static const StrokedOutlines* Insert(const Shape* shape,
+                                       const Matrix& transform,
+                                       StrokedOutlines* outlines);
+
+  static void Release(const StrokedOutlines* outlines);
+
+  // Drops every entry for a shape stored in shapes, which are about to be
+  // freed. Entries still in use are deleted by their last Release.
+  static void Purge(const std::vector<Shape>& shapes);
+};
+
+#endif
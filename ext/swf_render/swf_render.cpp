@@ -18,6 +18,8 @@
 #include <stdlib.h>
 
 #include "flash_rasterizer.h"
+#include "render_session.h"
+#include "spec_program.h"
 #include "utils.h"
 
 // Allocate two VALUE variables to hold the modules we'll create. Ruby values
@@ -32,25 +34,41 @@ extern "C" VALUE method_get_metadata(
   VALUE height,
   VALUE padding);
 
-extern "C" VALUE method_render(
+extern "C" VALUE method_render(int argc, VALUE* argv, VALUE self);
+
+extern "C" VALUE method_render_spec(int argc, VALUE* argv, VALUE self);
+
+extern "C" VALUE method_render_variants(int argc, VALUE* argv, VALUE self);
+
+extern "C" VALUE method_compile_spec(
   VALUE self,
   VALUE swf_name,
   VALUE class_name,
-  VALUE width,
-  VALUE height,
-  VALUE padding);
+  VALUE spec);
+
+extern "C" VALUE method_render_compiled(int argc, VALUE* argv, VALUE self);
 
-extern "C" VALUE method_render_spec(
+extern "C" VALUE method_open_session(int argc, VALUE* argv, VALUE self);
+
+extern "C" VALUE method_render_session(
+  VALUE self,
+  VALUE session,
+  VALUE spec);
+
+extern "C" VALUE method_render_raw(
   VALUE self,
   VALUE swf_name,
   VALUE class_name,
   VALUE spec,
   VALUE width,
   VALUE height,
-  VALUE padding);
-
+  VALUE padding,
+  VALUE format);
 
 extern "C" VALUE ResultClass = Qnil;
+extern "C" VALUE RawResultClass = Qnil;
+extern "C" VALUE CompiledSpecClass = Qnil;
+extern "C" VALUE SessionClass = Qnil;
 
 static void Result_free(void *s) {
   xfree(s);
@@ -86,6 +104,110 @@ static VALUE Result_get_data(VALUE r) {
   return rb_str_new((char*)result->data, result->size);
 }
 
+// A Result whose pixels are already a Ruby string, which get_data
+// returns as is rather than copying.
+struct RawResult {
+  Result result;
+  VALUE pixels;
+};
+
+static void RawResult_mark(void *s) {
+  rb_gc_mark(static_cast<RawResult*>(s)->pixels);
+}
+static VALUE RawResult_get_data(VALUE r) {
+  struct RawResult *raw;
+  Data_Get_Struct(r, struct RawResult, raw);
+  return raw->pixels;
+}
+static VALUE RawResult_get_width(VALUE r) {
+  struct RawResult *raw;
+  Data_Get_Struct(r, struct RawResult, raw);
+  return INT2NUM(raw->result.width);
+}
+static VALUE RawResult_get_height(VALUE r) {
+  struct RawResult *raw;
+  Data_Get_Struct(r, struct RawResult, raw);
+  return INT2NUM(raw->result.height);
+}
+static VALUE RawResult_get_stride(VALUE r) {
+  struct RawResult *raw;
+  Data_Get_Struct(r, struct RawResult, raw);
+  return INT2NUM(raw->result.stride);
+}
+
+// Renders straight into a new Ruby string.
+static unsigned char* allocate_pixels(size_t size, void* context) {
+  VALUE* pixels = static_cast<VALUE*>(context);
+  *pixels = rb_str_new(NULL, size);
+  return reinterpret_cast<unsigned char*>(RSTRING_PTR(*pixels));
+}
+
+static void CompiledSpec_free(void *s) {
+  delete static_cast<CompiledSpec*>(s);
+}
+static VALUE CompiledSpec_get_param_names(VALUE s) {
+  CompiledSpec *compiled;
+  Data_Get_Struct(s, CompiledSpec, compiled);
+  const SpecProgram& program = *compiled->program;
+  VALUE names = rb_ary_new2(program.num_params());
+  for (int i = 0; i < program.num_params(); i++) {
+    rb_ary_store(names, i, rb_str_new2(program.param_name(i).c_str()));
+  }
+  return names;
+}
+
+// Every method that encodes renders, and open_session, takes a hash of
+// options as its last, optional argument, which applies to that call
+// only. Copies it into config. :format is :png, the default, :qoi, :pam
+// or :ppm. :compression, for PNGs, is :fast for latency sensitive
+// requests, :small for offline batch jobs, or :default. Raises
+// ArgumentError for any other value.
+static void apply_options(VALUE options, RunConfig* config) {
+  if (NIL_P(options)) return;
+  Check_Type(options, T_HASH);
+  VALUE format = rb_hash_aref(options, ID2SYM(rb_intern("format")));
+  if (!NIL_P(format)) {
+    VALUE name = SYMBOL_P(format) ?
+        rb_sym_to_s(format) : rb_obj_as_string(format);
+    if (!ParseOutputFormat(StringValueCStr(name), &config->output_format)) {
+      rb_raise(rb_eArgError, "unknown output format %s", StringValueCStr(name));
+    }
+  }
+  VALUE compression = rb_hash_aref(options, ID2SYM(rb_intern("compression")));
+  if (!NIL_P(compression)) {
+    VALUE name = SYMBOL_P(compression) ?
+        rb_sym_to_s(compression) : rb_obj_as_string(compression);
+    if (!ParsePngCompression(StringValueCStr(name), &config->png_compression)) {
+      rb_raise(rb_eArgError, "unknown PNG compression %s", StringValueCStr(name));
+    }
+  }
+}
+
+static void Session_free(void *s) {
+  delete static_cast<RenderSession*>(s);
+}
+
+// Converts a Ruby parameter value: numbers as is, booleans as 1 or 0 and
+// strings (e.g. '0xff0000') as parsed by strtod.
+static double param_value(VALUE value) {
+  switch (TYPE(value)) {
+    case T_TRUE: return 1.0;
+    case T_FALSE:
+    case T_NIL: return 0.0;
+    case T_STRING: return strtod(StringValueCStr(value), NULL);
+    default: return NUM2DBL(value);
+  }
+}
+
+static int set_spec_arg(VALUE key, VALUE value, VALUE data) {
+  std::pair<const SpecProgram*, SpecArgs*>* p =
+      reinterpret_cast<std::pair<const SpecProgram*, SpecArgs*>*>(data);
+  VALUE name = SYMBOL_P(key) ? rb_sym_to_s(key) : rb_obj_as_string(key);
+  p->second->Set(p->first->ParamIndex(StringValueCStr(name)),
+                 param_value(value));
+  return ST_CONTINUE;
+}
+
 // Initial setup function, takes no arguments and returns nothing. Some API
 // notes:
 // 
@@ -102,8 +224,14 @@ void Init_swf_render() {
 
   SWFRender = rb_define_module("SWFRender");
   rb_define_singleton_method(SWFRender, "get_metadata", (VALUE(*)(...))method_get_metadata, 5);
-  rb_define_singleton_method(SWFRender, "render", (VALUE(*)(...))method_render, 5);
-  rb_define_singleton_method(SWFRender, "render_spec", (VALUE(*)(...))method_render_spec, 6);
+  rb_define_singleton_method(SWFRender, "render", (VALUE(*)(...))method_render, -1);
+  rb_define_singleton_method(SWFRender, "render_spec", (VALUE(*)(...))method_render_spec, -1);
+  rb_define_singleton_method(SWFRender, "render_variants", (VALUE(*)(...))method_render_variants, -1);
+  rb_define_singleton_method(SWFRender, "compile_spec", (VALUE(*)(...))method_compile_spec, 3);
+  rb_define_singleton_method(SWFRender, "render_compiled", (VALUE(*)(...))method_render_compiled, -1);
+  rb_define_singleton_method(SWFRender, "open_session", (VALUE(*)(...))method_open_session, -1);
+  rb_define_singleton_method(SWFRender, "render_session", (VALUE(*)(...))method_render_session, 2);
+  rb_define_singleton_method(SWFRender, "render_raw", (VALUE(*)(...))method_render_raw, 7);
 
 
   ResultClass = rb_define_class_under(SWFRender, "Result", rb_cObject);
@@ -113,6 +241,17 @@ void Init_swf_render() {
   rb_define_method(ResultClass, "get_natural_width", (VALUE(*)(...))Result_get_natural_width, 0);
   rb_define_method(ResultClass, "get_natural_height", (VALUE(*)(...))Result_get_natural_height, 0);
   rb_define_method(ResultClass, "get_data", (VALUE(*)(...))Result_get_data, 0);
+
+  RawResultClass = rb_define_class_under(SWFRender, "RawResult", ResultClass);
+  rb_define_method(RawResultClass, "get_data", (VALUE(*)(...))RawResult_get_data, 0);
+  rb_define_method(RawResultClass, "get_width", (VALUE(*)(...))RawResult_get_width, 0);
+  rb_define_method(RawResultClass, "get_height", (VALUE(*)(...))RawResult_get_height, 0);
+  rb_define_method(RawResultClass, "get_stride", (VALUE(*)(...))RawResult_get_stride, 0);
+
+  CompiledSpecClass = rb_define_class_under(SWFRender, "CompiledSpec", rb_cObject);
+  rb_define_method(CompiledSpecClass, "get_param_names", (VALUE(*)(...))CompiledSpec_get_param_names, 0);
+
+  SessionClass = rb_define_class_under(SWFRender, "Session", rb_cObject);
 }
 
 // The business logic -- this is the function we're exposing to Ruby. It returns
@@ -126,17 +265,14 @@ void Init_swf_render() {
 // * INT2NUM converts a C int to a Ruby Fixnum object
 // * rb_ary_store(VALUE, int, VALUE) sets the nth element of a Ruby array
 //
-VALUE method_render(
-    VALUE self,
-    VALUE swf_name,
-    VALUE class_name,
-    VALUE width,
-    VALUE height,
-    VALUE padding) {
+VALUE method_render(int argc, VALUE* argv, VALUE self) {
+  VALUE swf_name, class_name, width, height, padding, options;
+  rb_scan_args(argc, argv, "51", &swf_name, &class_name, &width, &height, &padding, &options);
   struct Result* result;
   result = ALLOC(struct Result);
   result->Init();
   RunConfig config;
+  apply_options(options, &config);
   config.input_swf = RSTRING_PTR(swf_name);
   config.class_name = RSTRING_PTR(class_name);
   config.width = NUM2INT(width);
@@ -146,18 +282,14 @@ VALUE method_render(
   return Data_Wrap_Struct(ResultClass, NULL, Result_free, result);
 }
 
-VALUE method_render_spec(
-    VALUE self,
-    VALUE swf_name,
-    VALUE class_name,
-    VALUE spec,
-    VALUE width,
-    VALUE height,
-    VALUE padding) {
+VALUE method_render_spec(int argc, VALUE* argv, VALUE self) {
+  VALUE swf_name, class_name, spec, width, height, padding, options;
+  rb_scan_args(argc, argv, "61", &swf_name, &class_name, &spec, &width, &height, &padding, &options);
   struct Result* result;
   result = ALLOC(struct Result);
   result->Init();
   RunConfig config;
+  apply_options(options, &config);
   config.input_swf = RSTRING_PTR(swf_name);
   config.class_name = RSTRING_PTR(class_name);
   config.spec = RSTRING_PTR(spec);
@@ -188,4 +320,148 @@ VALUE method_get_metadata(
   return Data_Wrap_Struct(ResultClass, NULL, Result_free, result);
 }
 
+// Renders every spec in the specs array and returns an array of results
+// in the same order. Much cheaper than calling render_spec for each.
+VALUE method_render_variants(int argc, VALUE* argv, VALUE self) {
+  VALUE swf_name, class_name, specs, width, height, padding, options;
+  rb_scan_args(argc, argv, "61", &swf_name, &class_name, &specs, &width, &height, &padding, &options);
+  Check_Type(specs, T_ARRAY);
+  const long count = RARRAY_LEN(specs);
+  std::vector<std::string> spec_strings;
+  for (long i = 0; i < count; i++) {
+    VALUE spec = rb_ary_entry(specs, i);
+    spec_strings.push_back(StringValueCStr(spec));
+  }
+  VALUE results = rb_ary_new2(count);
+  std::vector<Result*> result_structs;
+  for (long i = 0; i < count; i++) {
+    struct Result* result;
+    result = ALLOC(struct Result);
+    result->Init();
+    result_structs.push_back(result);
+    rb_ary_store(results, i, Data_Wrap_Struct(ResultClass, NULL, Result_free, result));
+  }
+  RunConfig config;
+  apply_options(options, &config);
+  config.input_swf = RSTRING_PTR(swf_name);
+  config.class_name = RSTRING_PTR(class_name);
+  config.width = NUM2INT(width);
+  config.height = NUM2INT(height);
+  config.padding = NUM2INT(padding);
+  std::vector<Result> rendered(count);
+  render_variants_to_png_buffers(config, spec_strings, count ? &rendered[0] : NULL);
+  for (long i = 0; i < count; i++) {
+    *result_structs[i] = rendered[i];
+  }
+  return results;
+}
+
+// Compiles spec against class_name once, for repeated rendering with
+// render_compiled. Returns nil if the swf has no such class.
+VALUE method_compile_spec(
+    VALUE self,
+    VALUE swf_name,
+    VALUE class_name,
+    VALUE spec) {
+  RunConfig config;
+  config.input_swf = RSTRING_PTR(swf_name);
+  config.class_name = RSTRING_PTR(class_name);
+  config.spec = RSTRING_PTR(spec);
+  CompiledSpec* compiled = compile_spec(config);
+  if (!compiled) return Qnil;
+  return Data_Wrap_Struct(CompiledSpecClass, NULL, CompiledSpec_free, compiled);
+}
+
+// Renders a compiled spec. params is a hash from parameter name to value
+// for the spec's $parameters, or nil.
+VALUE method_render_compiled(int argc, VALUE* argv, VALUE self) {
+  VALUE compiled_spec, params, width, height, padding, options;
+  rb_scan_args(argc, argv, "51", &compiled_spec, &params, &width, &height, &padding, &options);
+  CompiledSpec* compiled;
+  Data_Get_Struct(compiled_spec, CompiledSpec, compiled);
+  SpecArgs args(*compiled->program);
+  if (!NIL_P(params)) {
+    std::pair<const SpecProgram*, SpecArgs*> data(compiled->program, &args);
+    rb_hash_foreach(params, set_spec_arg, (VALUE)&data);
+  }
+  struct Result* result;
+  result = ALLOC(struct Result);
+  result->Init();
+  RunConfig config;
+  apply_options(options, &config);
+  config.width = NUM2INT(width);
+  config.height = NUM2INT(height);
+  config.padding = NUM2INT(padding);
+  render_compiled_to_png_buffer(*compiled, &args, config, result);
+  return Data_Wrap_Struct(ResultClass, NULL, Result_free, result);
+}
 
+// Opens an incremental rendering session for class_name at a fixed size.
+// Returns nil if the swf has no such class.
+VALUE method_open_session(int argc, VALUE* argv, VALUE self) {
+  VALUE swf_name, class_name, width, height, padding, options;
+  rb_scan_args(argc, argv, "51", &swf_name, &class_name, &width, &height, &padding, &options);
+  RunConfig config;
+  apply_options(options, &config);
+  config.input_swf = RSTRING_PTR(swf_name);
+  config.class_name = RSTRING_PTR(class_name);
+  config.width = NUM2INT(width);
+  config.height = NUM2INT(height);
+  config.padding = NUM2INT(padding);
+  RenderSession* session = open_session(config);
+  if (!session) return Qnil;
+  return Data_Wrap_Struct(SessionClass, NULL, Session_free, session);
+}
+
+// Renders spec in a session opened with open_session, repainting only
+// what changed since the session's previous render.
+VALUE method_render_session(
+    VALUE self,
+    VALUE session,
+    VALUE spec) {
+  RenderSession* render_session;
+  Data_Get_Struct(session, RenderSession, render_session);
+  struct Result* result;
+  result = ALLOC(struct Result);
+  result->Init();
+  render_session_to_png_buffer(render_session, StringValueCStr(spec), result);
+  return Data_Wrap_Struct(ResultClass, NULL, Result_free, result);
+}
+
+// Renders spec without encoding a PNG, returning a RawResult whose data
+// is the pixels in format: :rgba, :bgra, :rgba_premultiplied or
+// :bgra_premultiplied. Raises ArgumentError for any other format, and
+// returns nil if the swf has no such class.
+VALUE method_render_raw(
+    VALUE self,
+    VALUE swf_name,
+    VALUE class_name,
+    VALUE spec,
+    VALUE width,
+    VALUE height,
+    VALUE padding,
+    VALUE format) {
+  VALUE format_name = SYMBOL_P(format) ?
+      rb_sym_to_s(format) : rb_obj_as_string(format);
+  RawFormat raw_format;
+  if (!ParseRawFormat(StringValueCStr(format_name), &raw_format)) {
+    rb_raise(rb_eArgError, "unknown raw format %s", StringValueCStr(format_name));
+  }
+  RunConfig config;
+  config.input_swf = RSTRING_PTR(swf_name);
+  config.class_name = RSTRING_PTR(class_name);
+  config.spec = RSTRING_PTR(spec);
+  config.width = NUM2INT(width);
+  config.height = NUM2INT(height);
+  config.padding = NUM2INT(padding);
+  struct RawResult* raw;
+  raw = ALLOC(struct RawResult);
+  raw->result.Init();
+  raw->pixels = Qnil;
+  VALUE wrapped = Data_Wrap_Struct(RawResultClass, RawResult_mark, Result_free, raw);
+  if (render_to_raw_buffer(config, raw_format, allocate_pixels, &raw->pixels,
+                           &raw->result)) {
+    return Qnil;
+  }
+  return wrapped;
+}
@@ -0,0 +1,152 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+namespace {
+
+struct Job {
+  void (*fn)(int, void*);
+  void* context;
+  int count;
+  int next;
+  int max_workers;
+};
+
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+// Held by the thread whose job currently owns the pool.
+pthread_mutex_t caller_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+Job* current_job = NULL;
+unsigned generation = 0;
+int num_workers = 0;
+int busy_workers = 0;
+int thread_count = 0;
+
+__thread bool in_task = false;
+
+void RunTasks(Job* job) {
+  in_task = true;
+  for (;;) {
+    const int i = __sync_fetch_and_add(&job->next, 1);
+    if (i >= job->count) break;
+    job->fn(i, job->context);
+  }
+  in_task = false;
+}
+
+struct WorkerStart {
+  int id;
+  // The generation when the worker was created; it must join every job
+  // issued after that.
+  unsigned generation;
+};
+
+void* WorkerMain(void* arg) {
+  WorkerStart* start = static_cast<WorkerStart*>(arg);
+  const int id = start->id;
+  unsigned seen = start->generation;
+  delete start;
+  pthread_mutex_lock(&pool_mutex);
+  for (;;) {
+    while (generation == seen) {
+      pthread_cond_wait(&work_ready, &pool_mutex);
+    }
+    seen = generation;
+    Job* job = current_job;
+    pthread_mutex_unlock(&pool_mutex);
+    if (id < job->max_workers) {
+      RunTasks(job);
+    }
+    pthread_mutex_lock(&pool_mutex);
+    if (--busy_workers == 0) {
+      pthread_cond_signal(&work_done);
+    }
+  }
+  return NULL;
+}
+
+// A forked child has only the thread that called fork, so it starts
+// over with a fresh pool, whatever state the parent's was in.
+void ResetPoolInChild() {
+  pthread_mutex_init(&pool_mutex, NULL);
+  pthread_cond_init(&work_ready, NULL);
+  pthread_cond_init(&work_done, NULL);
+  pthread_mutex_init(&caller_mutex, NULL);
+  current_job = NULL;
+  num_workers = 0;
+  busy_workers = 0;
+}
+
+pthread_once_t fork_handler_once = PTHREAD_ONCE_INIT;
+
+void InstallForkHandler() {
+  pthread_atfork(NULL, NULL, ResetPoolInChild);
+}
+
+// Called with pool_mutex held.
+void StartWorkers(int count) {
+  pthread_once(&fork_handler_once, InstallForkHandler);
+  while (num_workers < count) {
+    WorkerStart* start = new WorkerStart();
+    start->id = num_workers;
+    start->generation = generation;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, WorkerMain, start) != 0) {
+      delete start;
+      break;
+    }
+    pthread_detach(thread);
+    ++num_workers;
+  }
+}
+
+}  // namespace
+
+int ThreadCount() {
+  if (thread_count > 0) return thread_count;
+  const long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+void SetThreadCount(int count) {
+  thread_count = count;
+}
+
+void ParallelFor(int count, void (*fn)(int i, void* context), void* context) {
+  const int workers = ThreadCount() - 1;
+  if (count <= 1 || workers <= 0 || in_task ||
+      pthread_mutex_trylock(&caller_mutex) != 0) {
+    for (int i = 0; i < count; i++) {
+      fn(i, context);
+    }
+    return;
+  }
+
+  Job job;
+  job.fn = fn;
+  job.context = context;
+  job.count = count;
+  job.next = 0;
+  job.max_workers = workers;
+
+  pthread_mutex_lock(&pool_mutex);
+  StartWorkers(workers);
+  current_job = &job;
+  busy_workers = num_workers;
+  ++generation;
+  pthread_cond_broadcast(&work_ready);
+  pthread_mutex_unlock(&pool_mutex);
+
+  RunTasks(&job);
+
+  pthread_mutex_lock(&pool_mutex);
+  while (busy_workers > 0) {
+    pthread_cond_wait(&work_done, &pool_mutex);
+  }
+  current_job = NULL;
+  pthread_mutex_unlock(&pool_mutex);
+  pthread_mutex_unlock(&caller_mutex);
+}
@@ -0,0 +1,51 @@
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <pthread.h>
+
+// Runs fn(i, context) for every i in [0, count), spreading the calls over
+// a pool of worker threads that is started on first use. The calling
+// thread takes part as well, and the call returns once every fn(i) has
+// finished. Indices are handed out one at a time, so uneven tasks balance
+// themselves. A ParallelFor issued from inside a task, or while another
+// thread's ParallelFor holds the pool, runs serially on the caller.
+void ParallelFor(int count, void (*fn)(int i, void* context), void* context);
+
+// Number of threads ParallelFor uses, counting the caller. Defaults to
+// the number of online processors.
+int ThreadCount();
+void SetThreadCount(int count);
+
+// Holds mutex locked while in scope.
+class ScopedLock {
+public:
+  explicit ScopedLock(pthread_mutex_t* mutex) : m_mutex(mutex) {
+    pthread_mutex_lock(m_mutex);
+  }
+  ~ScopedLock() { pthread_mutex_unlock(m_mutex); }
+private:
+  pthread_mutex_t* m_mutex;
+};
+
+// References to an entry that a process wide cache hands out to several
+// threads. An entry dropped from its cache while still in use is deleted
+// by its last user rather than by the cache. Guarded by the cache's lock.
+struct SharedEntry {
+  SharedEntry() : refs(0), evicted(false) {}
+
+  // Called once the entry is out of the cache. Returns true if nobody
+  // holds it, so the caller should delete it.
+  bool Evict() {
+    evicted = refs > 0;
+    return !evicted;
+  }
+
+  // Drops a reference. Returns true if the caller should delete the
+  // entry.
+  bool Release() { return --refs == 0 && evicted; }
+
+  int refs;
+  bool evicted;
+};
+
+#endif
@@ -19,8 +19,12 @@
 #define _COMMON_H
 
 ///////////////// Types //////////////////
+#ifndef TRUE
 #define TRUE    1
+#endif
+#ifndef FALSE
 #define FALSE   0
+#endif
 //////////////////////////////////////////
 
 // see http://en.wikipedia.org/wiki/Q_(number_format)
@@ -200,6 +200,14 @@ void ParsedSWF::Dump() const {
   printf(")");
 }
 
+ParsedSWF::~ParsedSWF() {
+  for (int i = 0; i < shapes.size(); i++) {
+    for (int j = 0; j < shapes[i].records.size(); j++) {
+      delete shapes[i].records[j];
+    }
+  }
+}
+
 const Sprite* ParsedSWF::SpriteByCharacterId(int character_id) const {
   std::map<int, int>::const_iterator it = character_id_to_sprite_index.find(character_id);
   if (it != character_id_to_sprite_index.end()) {
@@ -377,7 +385,7 @@ void TinySWFParser::HandlePlaceObject23(Tag* tag, Sprite* sprite, int current_fr
 //// PlaceObject3 SWF8 or later = 26
   unsigned int PlaceFlagHasClipActions, PlaceFlagHasClipDepth, PlaceFlagHasName, PlaceFlagHasRatio, PlaceFlagHasColorTransform, PlaceFlagHasMatrix, PlaceFlagHasCharacter, PlaceFlagHasMove;
   unsigned int PlaceFlagHasImage, PlaceFlagHasClassName, PlaceFlagHasCacheAsBitmap, PlaceFlagHasBlendMode, PlaceFlagHasFilterList;
-  unsigned int Depth, CharacterId, Ratio, ClipDepth;
+  unsigned int Depth, CharacterId, Ratio;
   setByteAlignment();
   PlaceFlagHasClipActions                = getUBits(1); // SWF5 and later (sprite characters only)
   PlaceFlagHasClipDepth                = getUBits(1);
@@ -419,21 +427,17 @@ void TinySWFParser::HandlePlaceObject23(Tag* tag, Sprite* sprite, int current_fr
           placement.name = getSTRING();
         }
         if (PlaceFlagHasClipDepth) {
-          printf("Warning: unhandled clipping mask.\n");
-          ClipDepth = getUI16();
+          placement.clip_depth = getUI16();
         }
     if (tag->TagCode == TAG_PLACEOBJECT3) {   // PlaceObject3 only
         if (PlaceFlagHasFilterList) {
           getFILTERLIST(&placement);
         }
         if (PlaceFlagHasBlendMode) {
-          printf("Warning: unhandled blend mode.\n");
-            unsigned int BlendMode;
-            BlendMode = getUI8();
+          placement.blend_mode = getUI8();
         }
         if (PlaceFlagHasCacheAsBitmap) {
-            unsigned int BitmapCache;
-            BitmapCache = getUI8();
+          placement.cache_as_bitmap = getUI8() != 0;
         }
     }
         if (PlaceFlagHasClipActions) {
@@ -832,29 +836,39 @@ int TinySWFParser::getTagCodeAndLength(Tag *tag)
 	return TRUE;
 }
 
+int TinySWFParser::getDROPSHADOWFILTER(Filter* filter)
+{
+  filter->rgba = getRGBA();
+  filter->blur_x = getFIXED();
+  filter->blur_y = getFIXED();
+  filter->angle = getFIXED();
+  filter->distance = getFIXED();
+  filter->strength = getFIXED8();
+  filter->inner = getUBits(1);
+  filter->knockout = getUBits(1);
+  filter->composite_source = getUBits(1);
+  filter->passes = getUBits(5);
+  return TRUE;
+}
+
 int TinySWFParser::getGLOWFILTER(Filter* filter)
 {
-  unsigned int InnerShadow, Knockout, CompositeSource, Passes;
-  float BlurX, BlurY, Strength;
   filter->rgba = getRGBA();
-  BlurX = getFIXED();
-  BlurY = getFIXED();
-  Strength = getFIXED8();
-  InnerShadow = getUBits(1);
-  Knockout = getUBits(1);
-  CompositeSource = getUBits(1);
-  Passes = getUBits(5);
+  filter->blur_x = getFIXED();
+  filter->blur_y = getFIXED();
+  filter->strength = getFIXED8();
+  filter->inner = getUBits(1);
+  filter->knockout = getUBits(1);
+  filter->composite_source = getUBits(1);
+  filter->passes = getUBits(5);
   return TRUE;
 }
 
 int TinySWFParser::getBLURFILTER(Filter* filter)
 {
-  printf("Warning: unhandled blur.\n");
-    float BlurX, BlurY;
-    BlurX = getFIXED();
-    BlurY = getFIXED();
-    unsigned int Passes;
-    Passes = getUBits(5);
+    filter->blur_x = getFIXED();
+    filter->blur_y = getFIXED();
+    filter->passes = getUBits(5);
     ASSERT(getUBits(3));    // Reserved, must be 0
     return TRUE;
 }
@@ -879,9 +893,8 @@ int TinySWFParser::getFILTERLIST(Placement* placement)    // SWF8 or later
           filter.filter_type = static_cast<Filter::FilterType>(getUI8());
             switch (filter.filter_type) {
                 case Filter::kFilterDropShadow:
-                  assert(false);
-                  //getDROPSHADOWFILTER(filter["DropShadowFilter"]);
-                    break;
+                  getDROPSHADOWFILTER(&filter);
+                  break;
                 case Filter::kFilterBlur:
                   getBLURFILTER(&filter);
                   break;
@@ -45,6 +45,10 @@ class FillStyle {
   Type type;
   unsigned int rgba;
   Matrix matrix;
+  bool IsGradient() const {
+    return type == kGradientLinear || type == kGradientRadial ||
+        type == kGradientFocal;
+  }
   // Expects coordinates in the untransformed gradient coordinate space.
   Color gradient_color(double grad_x, double grad_y) const;
   // Pairs of ratio (0.0-1.0), rgba
@@ -246,17 +250,41 @@ class Filter {
     kFilterColorMatrix,
     kFilterGradientBevel
   };
+  Filter()
+    : filter_type(kFilterBlur), rgba(0), blur_x(0), blur_y(0), passes(0),
+      angle(0), distance(0), strength(1), inner(false), knockout(false),
+      composite_source(true) {}
   FilterType filter_type;
   unsigned int rgba;
   ColorMatrix color_matrix;
+  // Box blur size in pixels and the number of times it is applied.
+  float blur_x;
+  float blur_y;
+  unsigned int passes;
+  // Shadow offset, in radians and pixels. Glows aren't offset.
+  float angle;
+  float distance;
+  float strength;
+  bool inner;
+  bool knockout;
+  bool composite_source;
 };
 
 class Placement {
  public:
- Placement() : character_id(-1), depth(-1) {}
+ Placement()
+   : character_id(-1), depth(-1), clip_depth(0), blend_mode(0),
+     cache_as_bitmap(false) {}
   bool operator<(const Placement& other) const { return depth < other.depth; }
   int character_id;
   int depth;
+  // If non-zero, this placement is a mask for the placements above it up
+  // to and including this depth, and isn't drawn itself.
+  int clip_depth;
+  // PlaceObject3 BlendMode; 0 and 1 are both normal.
+  int blend_mode;
+  // PlaceObject3 BitmapCache.
+  bool cache_as_bitmap;
   std::vector<Filter> filters;
   Matrix matrix;
   std::string name;
@@ -272,6 +300,7 @@ class Sprite {
 
 class ParsedSWF {
  public:
+  ~ParsedSWF();
   Rect frame_size;
   float frame_rate;
   unsigned int frame_count;
@@ -320,6 +349,7 @@ class TinySWFParser	: public SWFStream {
   int             getCOLORMATRIXFILTER(Filter* filter);
   int             getBLURFILTER(Filter* filter);
   int             getGLOWFILTER(Filter* filter);
+  int             getDROPSHADOWFILTER(Filter* filter);
 };
 
 #endif
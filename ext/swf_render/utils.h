@@ -22,18 +22,30 @@
 #ifndef _UTILS_H
 #define _UTILS_H
 
+#include "image_encoder.h"
+
 struct RunConfig {
   RunConfig() : output_png("out.png"),
   width(200),
   height(200),
-  padding(0) {}
+  padding(0),
+  output_format(kOutputPng),
+  png_compression(kPngDefault),
+  band_height(0) {}
   std::string input_swf;
+  // Written in output_format, whatever its extension.
   std::string output_png;
   std::string class_name;
   std::string spec;
   int width;
   int height;
   int padding;
+  OutputFormat output_format;
+  PngCompression png_compression;
+  // Rows rendered and encoded at a time by render_to_png_file, or 0 to
+  // only render in bands when the image is too big to hold at once. Only
+  // PNGs are written in bands.
+  int band_height;
 };
 
 struct Result {
@@ -45,6 +57,9 @@ struct Result {
     origin_y = 0;
     natural_width = 0;
     natural_height = 0;
+    width = 0;
+    height = 0;
+    stride = 0;
   }
   unsigned char* data;
   size_t size;
@@ -52,6 +67,10 @@ struct Result {
   double origin_y;
   int natural_width;
   int natural_height;
+  // Only set for raw pixels.
+  int width;
+  int height;
+  int stride;
 };
 
 #endif